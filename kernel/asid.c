@@ -0,0 +1,204 @@
+//
+// Address-space identifiers.
+//
+// The hardware tags each TLB entry with the ASID in satp, so
+// when processes have ASIDs of their own, entries of the kernel
+// (ASID 0) and of each process survive switches between them,
+// and trampoline.S need not flush the TLB on every trap.
+//
+// ASIDs are handed out in order as processes return to user
+// space. When they run out, a new generation starts: each
+// process gets a fresh ASID the next time it returns to user
+// space, and each hart flushes its TLB once before it runs
+// anything with an ASID of the new generation.
+//
+// The threads of a process share its address space and ASID.
+// Only the current hart's TLB can be flushed, so when a process
+// that has run on other harts changes its page table, it drops
+// its ASID instead (see asid_flush()); stale entries for the old
+// one go away at the next generation. Before freeing pages that
+// other threads may still reach through their harts' TLBs, it
+// waits for those harts to trap (see asid_shootdown()).
+//
+// Without ASIDs in the hardware, or when they are turned off
+// with asidctl(), processes run with ASID 0 and trampoline.S
+// flushes the TLB around each switch of page table.
+//
+// The largest ASID is kept for the kernel's user window (see
+// uwinopen() in vm.c), so that opening it flushes only its own
+// entries, and not those of the kernel and of every process.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+
+static struct {
+  struct spinlock lock;
+  uint64 gen;      // current generation, a multiple of asidmax+1
+  uint64 next;     // next unused ASID of this generation
+} asids;
+
+static uint64 asidmax;   // largest ASID the hardware has
+static uint64 asidlast;  // largest ASID processes get
+static uint64 uwinasid;  // the user window's, or 0
+static int enabled;
+
+// Find out how many ASID bits the hardware has.
+// Called once, after kvminithart() on the first hart.
+void
+asidinit(void)
+{
+  initlock(&asids.lock, "asid");
+
+  // satp's ASID field keeps only the bits that are implemented.
+  w_satp(r_satp() | SATP_ASID_MASK);
+  asidmax = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
+  w_satp(r_satp() & ~SATP_ASID_MASK);
+  sfence_vma();
+
+  asidlast = asidmax;
+  if(asidmax > 1)
+    uwinasid = asidlast--;
+
+  asids.gen = asidmax + 1;
+  asids.next = 1;
+  enabled = asidlast > 0;
+}
+
+// Return the satp value with which p should run on this hart,
+// giving p a new ASID if it has none of the current generation.
+// Called with interrupts off, on the way back to user space.
+uint64
+asid_satp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  struct vmspace *vm = p->vm;
+  uint64 gen;
+
+  if(!enabled)
+    return MAKE_SATP(vm->pagetable);
+
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if((vm->asid & ~asidmax) != gen){
+    acquire(&asids.lock);
+    // another thread may have got here first.
+    if((vm->asid & ~asidmax) != asids.gen){
+      if(asids.next > asidlast){
+        asids.gen += asidmax + 1;
+        asids.next = 1;
+      }
+      vm->asid = asids.gen | asids.next++;
+      vm->asidharts = 0;
+    }
+    gen = asids.gen;
+    release(&asids.lock);
+  }
+
+  // the ASIDs of a new generation may have been
+  // used in an earlier one on this hart.
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  }
+  __atomic_fetch_or(&vm->asidharts, 1 << cpuid(), __ATOMIC_RELAXED);
+
+  return MAKE_SATP_ASID(vm->pagetable, vm->asid & asidmax);
+}
+
+// vm's page table no longer maps va, or maps it with fewer
+// permissions; va == -1 means any address. Flush this hart's
+// stale TLB entries, or, if vm's threads may also have left some
+// in other harts' TLBs, drop vm's ASID. Caller must hold
+// vm->lock.
+void
+asid_flush(struct vmspace *vm, uint64 va)
+{
+  if(!enabled || vm->asid == 0)
+    return;
+
+  push_off();
+  if(vm->asidharts & ~(1 << cpuid()))
+    vm->asid = 0;
+  else if(va == -1)
+    sfence_vma_asid(vm->asid & asidmax);
+  else
+    sfence_vma_page(va, vm->asid & asidmax);
+  pop_off();
+}
+
+// Wait until every other hart that is running a thread of
+// address space vm has trapped into the kernel since vm's page
+// table was changed, and so has stopped using stale TLB entries.
+// xv6 has no inter-processor interrupts to make them flush, but
+// the timer interrupts each hart every tick.
+void
+asid_shootdown(struct vmspace *vm)
+{
+  uint64 seen[NCPU];
+  struct proc *p = myproc(), *q;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    seen[i] = __atomic_load_n(&cpus[i].ntrap, __ATOMIC_ACQUIRE);
+  for(i = 0; i < NCPU; i++){
+    for(;;){
+      q = __atomic_load_n(&cpus[i].proc, __ATOMIC_ACQUIRE);
+      if(q == 0 || q == p || q->vm != vm ||
+         __atomic_load_n(&cpus[i].ntrap, __ATOMIC_ACQUIRE) != seen[i])
+        break;
+      yield();
+    }
+  }
+}
+
+// vm's page table has a new mapping for va. The hardware may
+// have cached the old, invalid PTE, so flush it from this
+// hart's TLB. Another hart that still holds it will fault,
+// and vmfault() will find the page mapped.
+void
+asid_mapped(struct vmspace *vm, uint64 va)
+{
+  if(!enabled || vm->asid == 0)
+    return;
+
+  push_off();
+  sfence_vma_page(va, vm->asid & asidmax);
+  pop_off();
+}
+
+// The ASID with which the user window runs, or 0 if the
+// hardware has too few to keep one for it.
+uint64
+asid_uwin(void)
+{
+  return uwinasid;
+}
+
+// Turn ASIDs on or off, to compare the two.
+// Returns the old setting, or -1 if there are no ASIDs.
+int
+asidctl(int on)
+{
+  int old;
+
+  if(asidlast == 0)
+    return -1;
+
+  acquire(&asids.lock);
+  old = enabled;
+  if(on && !enabled){
+    // page table changes were not flushed
+    // by ASID while ASIDs were off.
+    asids.gen += asidmax + 1;
+    asids.next = 1;
+  }
+  enabled = on != 0;
+  release(&asids.lock);
+  return old;
+}
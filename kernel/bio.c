@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -8,6 +8,10 @@
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To have several blocks on their way to or from the disk at
+//     once, call bread_async or bwrite_async for each, then bwait.
+//     breadv and bwritev do the same for many blocks, moving runs
+//     of consecutive blocks in one disk request each.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -22,132 +26,693 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "virtio.h"
+#include "memstat.h"
 
-struct {
+// Buffers are found through a hash table of (dev, blockno),
+// each bucket with a lock of its own, so lookups of different
+// blocks do not contend. A buffer's refcnt is protected by the
+// lock of the bucket it is in.
+//
+// The cache starts with NBUF buffers, from a slab cache, and
+// a miss adds another while there are fewer than NBUFMAX and
+// memory is plentiful, or when every buffer is in use. When
+// kalloc() runs out of memory, bcache_shrink() frees the
+// unused buffers beyond the first NBUF.
+//
+// A miss that cannot add a buffer reuses one, chosen as in 2Q,
+// so that reading a large file once does not push out the
+// inode, bitmap and directory blocks everything else needs.
+// A block read for the first time goes on the A1in queue, a
+// FIFO; the reads that follow soon after (the rest of the
+// block, the next dirent) do not move it. When it falls off
+// the end of A1in its number is kept on the A1out list of
+// ghosts, and if it is read again while there, it was worth
+// caching, and goes on the Am queue instead. Am is a clock:
+// each use sets b->used, and the hand clears it, taking a
+// buffer that has not been used since it last came by. A1in
+// gives up its buffers once it holds more than a quarter of
+// the cache, so a scan cycles through A1in and leaves Am be.
+//
+// Growing, reusing and shrinking hold bcache.lock, which
+// orders it before any bucket lock; hits never take it.
+
+#define NBUCKET 251
+#define HASH(dev, blockno) ((((uint64)(dev) << 32) | (blockno)) % NBUCKET)
+
+// a miss adds a buffer only while more pages than this
+// are free, well above where zswap.c starts reclaiming.
+#define BGROWFREE 2048
+
+#define A1IN 0                // the queues, for b->queue
+#define AM   1
+#define NGHOST (NBUFMAX/2)    // blocks remembered on A1out
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;            // chain through b->next
+};
+
+// A queue is a ring through b->rnext and b->rprev. For
+// A1in the hand is the oldest buffer; for Am it is the
+// clock hand. Either way new buffers go just behind it.
+struct queue {
+  struct buf *hand;
+  int n;
+};
+
+// a block that was on A1in, by number only.
+struct ghost {
+  uint dev;
+  uint blockno;
+  int next;                    // hash chain, or -1
+  int hashed;                  // on a hash chain?
+};
+
+struct {
+  struct spinlock lock;        // growing, reusing and shrinking
+  struct queue q[2];           // A1IN and AM
+  int nbuf;
+
+  // A1out: NGHOST ghosts, replaced oldest first, and
+  // hashed like the buffers. Protected by bcache.lock.
+  struct ghost ghost[NGHOST];
+  int ghash[NBUCKET];
+  int gnext;
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 nmhit;                // of metadata blocks (see bcount())
+  uint64 nmmiss;
+  uint64 nevict;
+  uint64 nghosthit;
+  uint64 npinned;
+  uint64 nahead;
+  uint64 naheadhit;
+  uint64 nreq;                 // disk requests
+  uint64 nreqblk;              // blocks they moved
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct kmem_cache *bufcache;
+
+extern struct superblock sb;   // fs.c
+
+static int bcache_shrink(void);
+
+static void
+bufctor(void *p)
+{
+  initsleeplock(&((struct buf*)p)->lock, "buffer");
+}
+
+// Put b on queue qi, just behind the hand.
+// Caller holds bcache.lock.
+static void
+queue_add(int qi, struct buf *b)
+{
+  struct queue *q = &bcache.q[qi];
+
+  b->queue = qi;
+  if(q->hand == 0){
+    b->rnext = b->rprev = b;
+    q->hand = b;
+  } else {
+    b->rnext = q->hand;
+    b->rprev = q->hand->rprev;
+    b->rprev->rnext = b;
+    q->hand->rprev = b;
+  }
+  q->n++;
+}
+
+// Caller holds bcache.lock.
+static void
+queue_remove(struct buf *b)
+{
+  struct queue *q = &bcache.q[b->queue];
+
+  if(q->hand == b)
+    q->hand = b->rnext == b ? 0 : b->rnext;
+  b->rprev->rnext = b->rnext;
+  b->rnext->rprev = b->rprev;
+  q->n--;
+}
+
+// Take b out of bucket bk, whose lock is held.
+static void
+unhash(struct bucket *bk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->next)
+    ;
+  *pp = b->next;
+}
+
+// Take ghost g off its hash chain.
+// Caller holds bcache.lock.
+static void
+ghost_unhash(int g)
+{
+  struct ghost *gh = &bcache.ghost[g];
+  int *pp;
+
+  for(pp = &bcache.ghash[HASH(gh->dev, gh->blockno)]; *pp != g;
+      pp = &bcache.ghost[*pp].next)
+    ;
+  *pp = gh->next;
+  gh->hashed = 0;
+}
+
+// Remember that dev's blockno has left A1in,
+// forgetting the oldest ghost to make room.
+// Caller holds bcache.lock.
+static void
+ghost_add(uint dev, uint blockno)
+{
+  int g = bcache.gnext;
+  struct ghost *gh = &bcache.ghost[g];
+  int h = HASH(dev, blockno);
+
+  bcache.gnext = (g + 1) % NGHOST;
+  if(gh->hashed)
+    ghost_unhash(g);
+  gh->dev = dev;
+  gh->blockno = blockno;
+  gh->next = bcache.ghash[h];
+  gh->hashed = 1;
+  bcache.ghash[h] = g;
+}
+
+// Is dev's blockno on A1out? If so, forget it there.
+// Caller holds bcache.lock.
+static int
+ghost_take(uint dev, uint blockno)
+{
+  int g;
+
+  for(g = bcache.ghash[HASH(dev, blockno)]; g >= 0; g = bcache.ghost[g].next){
+    if(bcache.ghost[g].dev == dev && bcache.ghost[g].blockno == blockno){
+      ghost_unhash(g);
+      return 1;
+    }
+  }
+  return 0;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  for(int i = 0; i < NBUCKET; i++)
+    bcache.ghash[i] = -1;
+  bufcache = kmem_cache_create("buf", sizeof(struct buf), bufctor);
+  kshrinker(bcache_shrink);
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // the first buffers start out unused, as block 0 of device 0.
+  bk = &bcache.bucket[HASH(0, 0)];
+  for(int i = 0; i < NBUF; i++){
+    if((b = kmem_cache_alloc(bufcache)) == 0)
+      panic("binit");
+    b->dev = 0;
+    b->blockno = 0;
+    b->valid = 0;
+    b->disk = 0;
+    b->refcnt = 0;
+    b->used = 0;
+    b->next = bk->head;
+    bk->head = b;
+    queue_add(A1IN, b);
+    bcache.nbuf++;
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Find dev's blockno in bucket bk, whose lock is held.
 static struct buf*
-bget(uint dev, uint blockno)
+lookup(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+// If b is unused, and not being read ahead, take it out of its bucket and queue,
+// with refcnt 1, and return 1. Caller holds bcache.lock.
+static int
+take(struct buf *b)
+{
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  if(b->refcnt != 0 || b->disk){
+    release(&bk->lock);
+    return 0;
+  }
+  unhash(bk, b);
+  b->refcnt = 1;
+  release(&bk->lock);
+  queue_remove(b);
+  return 1;
+}
+
+// The oldest unused buffer on A1in, which becomes a ghost.
+static struct buf*
+evict_a1in(void)
+{
+  struct buf *b = bcache.q[A1IN].hand;
+
+  for(int i = 0; i < bcache.q[A1IN].n; i++, b = b->rnext){
+    if(take(b)){
+      if(b->valid)
+        ghost_add(b->dev, b->blockno);
       return b;
     }
   }
+  return 0;
+}
+
+// An unused buffer from Am, by the clock; twice round,
+// clearing used bits the first time.
+static struct buf*
+evict_am(void)
+{
+  struct queue *q = &bcache.q[AM];
+  struct buf *b;
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+  for(int i = 0; i < 2*q->n; i++){
+    b = q->hand;
+    q->hand = b->rnext;
+    if(b->used)
+      b->used = 0;
+    else if(take(b))
       return b;
+  }
+  return 0;
+}
+
+// Take an unused buffer out of the cache, with refcnt 1,
+// or return 0 if there is none. Caller holds bcache.lock.
+static struct buf*
+evict(void)
+{
+  struct buf *b = 0;
+
+  if(bcache.q[A1IN].n > bcache.nbuf/4 || bcache.q[AM].n == 0)
+    b = evict_a1in();
+  if(b == 0)
+    b = evict_am();
+  if(b == 0)
+    b = evict_a1in();
+  if(b)
+    bcache.nevict++;
+  return b;
+}
+
+// Add a buffer for dev's blockno, which was not cached a
+// moment ago, and return it with refcnt 1 and b->valid 0.
+// If another process cached the block meanwhile, return
+// that buffer with its refcnt raised instead. For ahead,
+// return 0 then, or when every buffer is in use. Does not
+// lock the buffer.
+static struct buf*
+bmiss(uint dev, uint blockno, int ahead)
+{
+  struct bucket *bk = &bcache.bucket[HASH(dev, blockno)];
+  struct buf *b, *nb = 0;
+  int force = 0;
+
+  // A new buffer must come from the slab cache before
+  // taking bcache.lock, which bcache_shrink() takes. If
+  // every buffer was in use last time round (the log may
+  // hold many at once), grow past the limits instead.
+again:
+  if(force || (bcache.nbuf < NBUFMAX && kfreepages() > BGROWFREE))
+    nb = kmem_cache_alloc(bufcache);
+  if(force && nb == 0)
+    panic("bget: no buffers");
+
+  // Another process may cache the block before this one
+  // holds bcache.lock, so look again.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = lookup(bk, dev, blockno)) != 0){
+    if(ahead)
+      b = 0;
+    else {
+      b->refcnt++;
+      b->used = 1;
     }
+    release(&bk->lock);
+    release(&bcache.lock);
+    if(nb)
+      kmem_cache_free(bufcache, nb);
+    return b;
+  }
+  release(&bk->lock);
+
+  if(nb && (force || bcache.nbuf < NBUFMAX)){
+    b = nb;
+    nb = 0;
+    b->refcnt = 1;
+    bcache.nbuf++;
+  } else if((b = evict()) == 0){
+    release(&bcache.lock);
+    if(nb)
+      kmem_cache_free(bufcache, nb);
+    if(ahead)
+      return 0;
+    nb = 0;
+    force = 1;
+    goto again;
   }
-  panic("bget: no buffers");
+  if(ghost_take(dev, blockno)){
+    bcache.nghosthit++;
+    queue_add(AM, b);
+  } else
+    queue_add(A1IN, b);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->disk = 0;
+  b->ahead = 0;
+  b->used = 0;
+  if(ahead){
+    // bread() waits for b->disk to clear before using b,
+    // so set it before anyone else can find b.
+    b->valid = 1;
+    b->disk = 1;
+    b->ahead = 1;
+  }
+  acquire(&bk->lock);
+  b->next = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  if(nb)
+    kmem_cache_free(bufcache, nb);
+  return b;
 }
 
-// Return a locked buf with the contents of the indicated block.
-struct buf*
-bread(uint dev, uint blockno)
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket *bk = &bcache.bucket[HASH(dev, blockno)];
+  struct buf *b;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  if((b = lookup(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    b->used = 1;
+    release(&bk->lock);
+  } else {
+    release(&bk->lock);
+    b = bmiss(dev, blockno, 0);
+  }
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Count a bread of b, before reading it if need be. Blocks
+// before the data area (log, inode and bitmap) count as
+// metadata, as do those read with meta set (bread_meta()).
+static void
+bcount(struct buf *b, int meta)
+{
+  meta = meta || b->blockno < sb.bmapstart + sb.size/BPB + 1;
+  if(b->ahead){
+    b->ahead = 0;
+    __atomic_fetch_add(&bcache.naheadhit, 1, __ATOMIC_RELAXED);
+  }
+  if(!b->valid) {
+    __atomic_fetch_add(&bcache.nmiss, 1, __ATOMIC_RELAXED);
+    if(meta)
+      __atomic_fetch_add(&bcache.nmmiss, 1, __ATOMIC_RELAXED);
+  } else {
+    __atomic_fetch_add(&bcache.nhit, 1, __ATOMIC_RELAXED);
+    if(meta)
+      __atomic_fetch_add(&bcache.nmhit, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// Start the disk moving the n buffers, which hold
+// consecutive blocks, in as few requests as it can,
+// by way of the I/O scheduler.
+static void
+bstart(struct buf **bufs, int n, int write)
+{
+  iosched_submit(bufs, n, write);
+  __atomic_fetch_add(&bcache.nreq, (n + MAXSEG - 1) / MAXSEG, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&bcache.nreqblk, n, __ATOMIC_RELAXED);
+}
+
+// bread_async(), with meta as for bcount().
+static struct buf*
+bread1(uint dev, uint blockno, int meta)
 {
   struct buf *b;
 
   b = bget(dev, blockno);
+  bcount(b, meta);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    bstart(&b, 1, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, with the disk
+// reading its contents if they are not cached; bwait() before
+// looking at b->data. Lets a caller have several blocks on
+// their way from the disk at once.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  return bread1(dev, blockno, 0);
+}
+
+// Return a locked buf with the contents of the indicated block.
+struct buf*
+bread(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bread_async(dev, blockno);
+  bwait(b);
+  return b;
+}
+
+// bread() of a data block that holds metadata, such as
+// a directory's, to be counted with the metadata blocks.
+struct buf*
+bread_meta(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bread1(dev, blockno, 1);
+  bwait(b);
+  return b;
+}
+
+// bread_async() of the n blocks from blockno on, into
+// bufs[], reading each run of them that is not cached
+// with a single disk request.
+void
+breadv(uint dev, uint blockno, int n, struct buf **bufs)
+{
+  int i, j;
+
+  for(i = 0; i < n; i++){
+    bufs[i] = bget(dev, blockno + i);
+    bcount(bufs[i], 0);
+  }
+  for(i = 0; i < n; i = j){
+    for(j = i; j < n && !bufs[j]->valid; j++)
+      bufs[j]->valid = 1;
+    if(j > i)
+      bstart(bufs + i, j - i, 0);
+    else
+      j++;
+  }
+}
+
+// Start reading a block into the cache, if it is not there
+// already, without waiting for the disk or locking the
+// buffer; a bread() of the block waits instead. For
+// readahead() in fs.c.
+void
+breada(uint dev, uint blockno)
+{
+  struct bucket *bk = &bcache.bucket[HASH(dev, blockno)];
+  struct buf *b;
+
+  acquire(&bk->lock);
+  b = lookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b || (b = bmiss(dev, blockno, 1)) == 0)
+    return;
+
+  bstart(&b, 1, 0);
+  __atomic_fetch_add(&bcache.nahead, 1, __ATOMIC_RELAXED);
+
+  acquire(&bk->lock);
+  b->refcnt--;
+  release(&bk->lock);
+}
+
+// Start writing b's contents to disk, without waiting;
+// bwait() before changing b->data. Must be locked.
+void
+bwrite_async(struct buf *b)
+{
+  bwritev(&b, 1);
+}
+
+// bwrite_async() each of the n distinct buffers, writing each
+// run of consecutive blocks among them with one disk request.
+void
+bwritev(struct buf **bufs, int n)
+{
+  int i, j;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+    bwait(bufs[i]);
+  }
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n; j++)
+      if(bufs[j]->dev != bufs[i]->dev || bufs[j]->blockno != bufs[j-1]->blockno + 1)
+        break;
+    bstart(bufs + i, j - i, 1);
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bwritev(&b, 1);
+  bwait(b);
+}
+
+// Wait for the disk to finish with b, after bread_async(),
+// bwrite_async() or read-ahead. Must be locked.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  if(b->disk)
+    iosched_wait(b, 0);
+}
+
+// bwrite() b, for a caller that cannot go on until it is
+// on the disk, such as a log commit, which may poll for it
+// rather than sleep (see virtio_disk_poll()). Must be locked.
+void
+bsync(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bsync");
+  bwritev(&b, 1);
+  if(b->disk)
+    iosched_wait(b, 1);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
+  bwait(b);
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
+  __atomic_fetch_add(&bcache.npinned, 1, __ATOMIC_RELAXED);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[HASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
+  __atomic_fetch_sub(&bcache.npinned, 1, __ATOMIC_RELAXED);
 }
 
+// Free the unused buffers beyond the first NBUF, from
+// A1in first. Called by kalloc when memory runs out.
+static int
+bcache_shrink(void)
+{
+  struct buf *b, *next;
+  int qi, i, n = 0;
+
+  acquire(&bcache.lock);
+  for(qi = A1IN; qi <= AM; qi++){
+    b = bcache.q[qi].hand;
+    for(i = bcache.q[qi].n; i > 0 && bcache.nbuf > NBUF; i--, b = next){
+      next = b->rnext;
+      if(!take(b))
+        continue;
+      bcache.nbuf--;
+      kmem_cache_free(bufcache, b);
+      n++;
+    }
+  }
+  release(&bcache.lock);
+  return n;
+}
 
+// Fill in the buffer cache part of a struct memstat.
+void
+bcachestat(struct memstat *st)
+{
+  acquire(&bcache.lock);
+  st->nbuf = bcache.nbuf;
+  st->nbufa1 = bcache.q[A1IN].n;
+  st->bhit = bcache.nhit;
+  st->bmiss = bcache.nmiss;
+  st->bmhit = bcache.nmhit;
+  st->bmmiss = bcache.nmmiss;
+  st->bevict = bcache.nevict;
+  st->bghosthit = bcache.nghosthit;
+  st->bpinned = bcache.npinned;
+  st->bahead = bcache.nahead;
+  st->baheadhit = bcache.naheadhit;
+  st->breq = bcache.nreq;
+  st->breqblk = bcache.nreqblk;
+  release(&bcache.lock);
+}
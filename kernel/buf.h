@@ -5,8 +5,13 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  int ahead;   // read ahead, and not yet by bread()
+  int used;    // used since the clock hand last came by (see bio.c)
+  struct buf *next; // hash chain
+  struct buf *ionext; // rest of the same disk request (see virtio_disk.c)
+  int queue;   // A1IN or AM (see bio.c)
+  struct buf *rnext; // ring of the buffers on the same queue
+  struct buf *rprev;
   uchar data[BSIZE];
 };
 
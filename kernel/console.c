@@ -81,17 +81,21 @@ consolewrite(int user_src, uint64 src, int n)
 // copy (up to) a whole input line to dst.
 // user_dst indicates whether dst is a user
 // or kernel address.
+// the line is gathered into buf and copied out
+// after cons.lock is released, since a page
+// fault in either_copyout() may sleep.
 //
 int
 consoleread(int user_dst, uint64 dst, int n)
 {
-  uint target;
-  int c;
-  char cbuf;
+  int c, i;
+  char buf[INPUT_BUF_SIZE];
 
-  target = n;
+  if(n > INPUT_BUF_SIZE)
+    n = INPUT_BUF_SIZE;
+  i = 0;
   acquire(&cons.lock);
-  while(n > 0){
+  while(i < n){
     // wait until interrupt handler has put some
     // input into cons.buffer.
     while(cons.r == cons.w){
@@ -105,7 +109,7 @@ consoleread(int user_dst, uint64 dst, int n)
     c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
 
     if(c == C('D')){  // end-of-file
-      if(n < target){
+      if(i > 0){
         // Save ^D for next time, to make sure
         // caller gets a 0-byte result.
         cons.r--;
@@ -113,13 +117,7 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
-
-    dst++;
-    --n;
+    buf[i++] = c;
 
     if(c == '\n'){
       // a whole line has arrived, return to
@@ -129,7 +127,12 @@ consoleread(int user_dst, uint64 dst, int n)
   }
   release(&cons.lock);
 
-  return target - n;
+  // copy the input bytes to the user-space buffer.
+  // a bad address loses them.
+  if(i > 0 && either_copyout(user_dst, dst, buf, i) == -1)
+    return -1;
+
+  return i;
 }
 
 //
@@ -2,20 +2,42 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct memstat;
 struct pipe;
+struct readahead;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct vmspace;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bread_meta(uint, uint);
+struct buf*     bread_async(uint, uint);
+void            breadv(uint, uint, int, struct buf**);
+void            breada(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_async(struct buf*);
+void            bwritev(struct buf**, int);
+void            bwait(struct buf*);
+void            bsync(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bcachestat(struct memstat*);
+
+// iosched.c
+void            ioschedinit(void);
+void            iosched_submit(struct buf**, int, int);
+void            iosched_done(struct buf*);
+void            iosched_wait(struct buf*, int);
+void            ioschedstat(struct memstat*);
 
 // console.c
 void            consoleinit(void);
@@ -23,7 +45,7 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
-int             kexec(char*, char**);
+int             kexec(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -50,6 +72,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            readahead(struct inode*, struct readahead*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -59,6 +82,14 @@ void            ireclaim(int);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            kmemstat(struct memstat*);
+int             kalloctest(int, int, int);
+void            kshrinker(int (*)(void));
+void            kdup(void*);
+int             krefs(void*);
+uint64          kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -66,7 +97,19 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// pagecache.c
+void            pcacheinit(void);
+void*           pcache_get(struct inode*, uint, uint);
+void            pcache_put(struct inode*, uint, uint, void*);
+void*           pcache_shared(struct inode*, uint);
+void            pcache_write(struct inode*, uint, char*, uint);
+void            pcache_inval(struct inode*);
+void            pcache_trunc(struct inode*);
+void            pcache_evict(struct inode*);
+void            pcachestat(struct memstat*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -81,10 +124,18 @@ void            printfinit(void);
 int             cpuid(void);
 void            kexit(int);
 int             kfork(void);
+int             kclone(uint64, uint64, uint64);
+int             kspawn(char*, char**, int*);
+void            kthread(char*, void (*)(void));
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+struct vmspace* vmspace_alloc(struct proc*);
+void            vmspace_free(struct vmspace*);
+int             vmspace_put(struct proc*);
+int             futex_wait(uint64, int);
+int             futex_wake(uint64, int);
 int             kkill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -102,6 +153,14 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// uaccess.S
+int             uaccess_copy(void*, void*, uint64);
+
+// vstring.S
+void            vmemmove(void*, const void*, uint);
+void            vmemset(void*, int, uint);
+int             vmemcmp(const void*, const void*, uint);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -113,13 +172,31 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// shm.c
+void            shminit(void);
+int             shmalloc(uint64, struct file**);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+uint64          shmattach(struct proc*, struct shm*);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint, void (*)(void*));
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabstat(struct memstat*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
+extern int      hasrvv;
+extern int      hascboz;
+void            stringinit(void);
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
@@ -150,6 +227,35 @@ void            uartwrite(char [], int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
+// asid.c
+void            asidinit(void);
+uint64          asid_satp(struct proc*);
+void            asid_flush(struct vmspace*, uint64);
+void            asid_mapped(struct vmspace*, uint64);
+void            asid_shootdown(struct vmspace*);
+uint64          asid_uwin(void);
+int             asidctl(int);
+
+// swap.c
+void            swapinit(void);
+int             swapon(void);
+int             swap_out(void*, pte_t*, int*);
+void            swap_wait(int*);
+uint64          swap_in(pte_t*);
+void            swap_dup(pte_t);
+void            swap_drop(pte_t);
+void            swapstat(struct memstat*);
+
+// zswap.c
+void            zswapinit(void);
+void            zswap_balance(void);
+uint64          zswap_in(pte_t*);
+void            zswap_dup(pte_t);
+void            zswap_drop(pte_t);
+void            zswap_forget(struct vmspace*);
+int             zswapctl(int);
+void            zswapstat(struct memstat*);
+
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
@@ -169,6 +275,22 @@ int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 int             ismapped(pagetable_t, uint64);
 uint64          vmfault(pagetable_t, uint64, int);
+void            uvmpin(uint64, int, int);
+void            uvmunpin(void);
+void            uwinopen(void);
+void            uwinclose(void);
+int             uwinfault(uint64, int);
+
+// vma.c
+struct vma*     vma_find(struct proc*, uint64);
+uint64          vma_page(struct vma*, uint64);
+int             vma_dup(struct proc*, struct proc*);
+void            vma_free(struct vma*);
+void            vma_trim(struct proc*, uint64);
+uint64          vma_limit(struct proc*);
+uint64          vma_map(struct proc*, uint64, int, int, struct inode*, uint, uint);
+int             vma_unmap(struct proc*, uint64, uint64);
+int             vma_release(struct proc*);
 
 // plic.c
 void            plicinit(void);
@@ -178,8 +300,14 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+int             virtio_disk_rw_trystart(struct buf *, int);
+void            virtio_disk_rw_poll(int *, int);
+uint64          virtio_disk_size(int);
+int             virtio_disk_start(int, uint64, void*, uint, int, int*);
+void            virtio_disk_wait(int, int*);
+void            virtio_disk_stat(struct memstat*);
+int             virtio_disk_poll(int);
+void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
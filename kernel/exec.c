@@ -3,12 +3,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 // map ELF permissions to PTE permission bits.
 int flags2perm(int flags)
 {
@@ -21,10 +20,12 @@ int flags2perm(int flags)
 }
 
 //
-// the implementation of the exec() system call
+// the implementation of the exec() system call: replace p's
+// user memory with the program in path. p is the caller, or
+// a child being made by spawn() that has no memory yet.
 //
 int
-kexec(char *path, char **argv)
+kexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -32,8 +33,12 @@ kexec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  pagetable_t pagetable = 0;
+  struct vmspace *vm = 0;
+  struct vma vma[NVMA], *v;
+
+  memset(vma, 0, sizeof(vma));
+  v = vma;
 
   begin_op();
 
@@ -52,10 +57,12 @@ kexec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  if((vm = vmspace_alloc(p)) == 0)
     goto bad;
+  pagetable = vm->pagetable;
 
-  // Load program into memory.
+  // Record where each segment's pages come from; vmfault()
+  // reads them in from ip when the program first touches them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -67,29 +74,45 @@ kexec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr + ph.memsz > TRAPFRAME || ph.off + ph.filesz < ph.off)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(v == &vma[NVMA])
       goto bad;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->perm = flags2perm(ph.flags) | PTE_R | PTE_U;
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    v++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
-  // Allocate some pages at the next page boundary.
-  // Make the first inaccessible as a stack guard.
-  // Use the rest as the user stack.
+  // Reserve USERSTACKMAX pages at the next page boundary for
+  // the user stack, above an inaccessible guard page. Only the
+  // top USERSTACK pages are allocated now; vmfault() fills in
+  // the rest as the stack grows down into them.
   sz = PGROUNDUP(sz);
-  uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + (USERSTACK+1)*PGSIZE, PTE_W)) == 0)
+  if(v + 2 > &vma[NVMA])
+    goto bad;
+  v->start = sz;
+  v->end = sz + PGSIZE;
+  v->flags = VMA_STACK;  // no PTE_U: faults here kill
+  v++;
+  v->start = sz + PGSIZE;
+  v->end = v->start + USERSTACKMAX*PGSIZE;
+  v->perm = PTE_R | PTE_W | PTE_U;
+  v->flags = VMA_STACK;
+  sz = v->end;
+  v++;
+  if(uvmalloc(pagetable, sz - USERSTACK*PGSIZE, sz, PTE_W) == 0)
     goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz-(USERSTACK+1)*PGSIZE);
   sp = sz;
   stackbase = sp - USERSTACK*PGSIZE;
 
@@ -127,47 +150,30 @@ kexec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  // Commit to the user image, leaving the old one
+  // to any other threads that share it.
+  if(p->vm)
+    vmspace_put(p);
+  vm->sz = sz;
+  memmove(vm->vma, vma, sizeof(vma));
+  acquire(&p->lock);
+  p->vm = vm;
+  release(&p->lock);
+  p->tfva = TRAPFRAME;
   p->trapframe->epc = elf.entry;  // initial program counter = ulib.c:start()
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
+  if(vm){
+    vm->sz = sz;
+    vmspace_free(vm);
+  }
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  vma_free(vma);
   return -1;
 }
-
-// Load an ELF program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
@@ -1,11 +1,20 @@
+// sequential read-ahead state of an open file (see readahead() in fs.c).
+struct readahead {
+  uint off;          // where the next read is, if sequential
+  uint win;          // blocks to read ahead, or 0
+  uint next;         // first block not yet read ahead
+};
+
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_SHM } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
+  struct shm *shm;   // FD_SHM
   uint off;          // FD_INODE
+  struct readahead ra; // FD_INODE
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +27,8 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // in the inode table's list
+  int npcache;        // pages in the page cache; see pagecache.c
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
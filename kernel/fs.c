@@ -15,8 +15,8 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -130,18 +130,18 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref is zero is unused, but stays in the table,
+//   still valid, until it is reclaimed.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -170,24 +170,43 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
 //
+// Entries are allocated from a slab cache when an inode is
+// first referenced. When the last reference goes, the entry
+// stays in the table, so that opening the file again need not
+// read its dinode, and its pages in the page cache (see
+// pagecache.c) stay shared. The table keeps at most NINODE
+// unused entries, freeing the one unused longest beyond that,
+// and frees them all when memory runs out (itable_shrink()).
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+// itable.lock must not be held across a call to kalloc()
+// or kmem_cache_alloc(), which may call itable_shrink().
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *inode;  // list of entries, most recently used first
+  int ninode;
+  int nunused;          // entries with ref == 0
 } itable;
 
+static struct kmem_cache *inodecache;
+
+static int itable_shrink(void);
+
+static void
+inodector(void *p)
+{
+  initsleeplock(&((struct inode*)p)->lock, "inode");
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  inodecache = kmem_cache_create("inode", sizeof(struct inode), inodector);
+  kshrinker(itable_shrink);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -247,29 +266,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *nip = 0;
 
   acquire(&itable.lock);
-
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
+  for(;;){
+    // Is the inode already in the table?
+    for(ip = itable.inode; ip; ip = ip->next){
+      if(ip->dev == dev && ip->inum == inum){
+        if(ip->ref++ == 0)
+          itable.nunused--;
+        release(&itable.lock);
+        if(nip)
+          kmem_cache_free(inodecache, nip);
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+    if(nip)
+      break;
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    // Allocate an inode entry, without itable.lock,
+    // and look again.
+    release(&itable.lock);
+    if((nip = kmem_cache_alloc(inodecache)) == 0)
+      panic("iget: no inodes");
+    acquire(&itable.lock);
+  }
+  ip = nip;
+  itable.ninode++;
+  ip->next = itable.inode;
+  itable.inode = ip;
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
+  ip->npcache = 0;
   ip->ref = 1;
   ip->valid = 0;
   release(&itable.lock);
@@ -288,6 +317,22 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Take unused ip out of the table and free it, with its
+// pages in the page cache. Caller holds itable.lock.
+static void
+ifree(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.inode; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  itable.ninode--;
+  itable.nunused--;
+  pcache_evict(ip);
+  kmem_cache_free(inodecache, ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -328,8 +373,9 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry
+// becomes unused, and is kept unless there are more than
+// NINODE unused entries.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -358,10 +404,50 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    struct inode **pp, *e, *lru = 0;
+
+    itable.nunused++;
+    if(!ip->valid){
+      // freed on disk, or never read: not worth keeping.
+      ifree(ip);
+    } else {
+      // to the front of the list, and free the entry
+      // unused longest if there are too many.
+      for(pp = &itable.inode; *pp != ip; pp = &(*pp)->next)
+        ;
+      *pp = ip->next;
+      ip->next = itable.inode;
+      itable.inode = ip;
+      if(itable.nunused > NINODE){
+        for(e = itable.inode; e; e = e->next)
+          if(e->ref == 0)
+            lru = e;
+        ifree(lru);
+      }
+    }
+  }
   release(&itable.lock);
 }
 
+// Free the unused inode table entries.
+// Called by kalloc when memory runs out; the entries go back
+// to the slab cache, whose own shrinker returns the pages.
+static int
+itable_shrink(void)
+{
+  struct inode *ip, *next;
+
+  acquire(&itable.lock);
+  for(ip = itable.inode; ip; ip = next){
+    next = ip->next;
+    if(ip->ref == 0)
+      ifree(ip);
+  }
+  release(&itable.lock);
+  return 0;
+}
+
 // Common idiom: unlock, then put.
 void
 iunlockput(struct inode *ip)
@@ -452,6 +538,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcache_trunc(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -506,7 +594,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
+    bp = ip->type == T_DIR ? bread_meta(ip->dev, addr) : bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -518,6 +606,56 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Read-ahead: a read that starts where the last one on the
+// same open file ended is sequential, and starts the disk
+// reading the blocks after it, so that they are cached by
+// the time readi() gets to them. The window of blocks to
+// keep read ahead doubles with each sequential read, from
+// RAMIN up to RAMAX, and a read anywhere else closes it.
+#define RAMIN 4
+#define RAMAX 32
+
+// Called by fileread() before readi(ip, ..., off, n).
+// Caller must hold ip->lock.
+void
+readahead(struct inode *ip, struct readahead *ra, uint off, uint n)
+{
+  uint bn, last, end, addr;
+  struct buf *bp = 0;
+
+  if(off != ra->off || n == 0 || off >= ip->size){
+    ra->off = off + n;
+    ra->win = 0;
+    ra->next = 0;
+    return;
+  }
+  ra->off = off + n;
+  ra->win = ra->win == 0 ? RAMIN : min(2 * ra->win, RAMAX);
+
+  // from the block after this read's last, up to the window,
+  // but not past the end of the file.
+  last = (min(off + n, ip->size) - 1) / BSIZE;
+  end = min(last + 1 + ra->win, (ip->size + BSIZE - 1) / BSIZE);
+  for(bn = ra->next > last ? ra->next : last + 1; bn < end; bn++){
+    if(bn < NDIRECT)
+      addr = ip->addrs[bn];
+    else {
+      if(bp == 0){
+        if(ip->addrs[NDIRECT] == 0)
+          break;
+        bp = bread(ip->dev, ip->addrs[NDIRECT]);
+      }
+      addr = ((uint*)bp->data)[bn - NDIRECT];
+    }
+    if(addr == 0)
+      break;
+    breada(ip->dev, addr);
+  }
+  if(bp)
+    brelse(bp);
+  ra->next = bn;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -536,16 +674,21 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->npcache > 0)
+    pcache_inval(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
+    bp = ip->type == T_DIR ? bread_meta(ip->dev, addr) : bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
+    if(ip->npcache > 0)
+      pcache_write(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -678,8 +821,11 @@ namex(char *path, int nameiparent, char *name)
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    acquire(&myproc()->files->lock);
+    ip = idup(myproc()->files->cwd);
+    release(&myproc()->files->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -0,0 +1,232 @@
+//
+// I/O scheduler, between the buffer cache and the disk.
+//
+// bio.c hands each disk request here (iosched_submit()), for a
+// run of consecutive blocks. It goes straight to the disk if
+// the hart's virtqueue has room for it, so that the disk sees
+// as many requests at once as its queues hold. Once a queue is
+// full, requests wait on a queue for the process that issued
+// them, kept in block order, where a request for the blocks
+// just before or after another of the same kind is merged
+// into it, up to MAXSEG blocks.
+//
+// When a request finishes and makes room, the queues take
+// turns as in a stride scheduler: each has a pass, and the
+// one with the lowest pass goes next, adding to its pass its
+// stride (STRIDE1 over its process's lottery tickets) for
+// each block. So while the disk is saturated, processes get
+// its bandwidth in proportion to their tickets, as they get
+// the CPU (see scheduler() in proc.c), and a process writing
+// much does not starve one reading a little. From a queue,
+// the next request is the first at or past the block where
+// the last one ended, wrapping around, as an elevator goes.
+//
+// Readahead is charged to the process reading, and a log
+// commit to the process whose end_op() does it.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "virtio.h"
+#include "memstat.h"
+
+#define STRIDE1 (1 << 20)
+#define NIOQ (NPROC + 1)       // one per process, and one for none
+
+struct ioreq {
+  struct ioreq *next;          // on its queue, by blockno
+  struct buf *bufs;            // the blocks, by b->ionext
+  struct buf *last;
+  uint blockno;
+  int n;
+  int write;
+};
+
+struct ioq {
+  struct ioreq *head;
+  uint64 pass;
+  uint64 stride;
+};
+
+// io.lock protects everything here, and b->disk of buffers
+// handed to iosched_submit(). It is taken before the disk's
+// queue locks, and so never while holding one.
+static struct {
+  struct spinlock lock;
+  struct ioq q[NIOQ];
+  int npending;                // requests on the queues
+  uint64 vtime;                // pass of the queue that went last
+  uint pos;                    // block just past the last request
+
+  uint64 nmerge;
+  uint64 nqueued;
+} io;
+
+static struct kmem_cache *reqcache;
+
+extern struct proc proc[NPROC];
+
+void
+ioschedinit(void)
+{
+  initlock(&io.lock, "iosched");
+  reqcache = kmem_cache_create("ioreq", sizeof(struct ioreq), 0);
+}
+
+// Start requests from the queues while the disk has room.
+// Caller holds io.lock.
+static void
+dispatch(void)
+{
+  struct ioq *q, *best;
+  struct ioreq *r, **rp, **pick;
+
+  while(io.npending > 0){
+    best = 0;
+    for(q = io.q; q < &io.q[NIOQ]; q++)
+      if(q->head && (best == 0 || q->pass < best->pass))
+        best = q;
+
+    // the first request at or past io.pos, or else the first.
+    pick = &best->head;
+    for(rp = &best->head; *rp; rp = &(*rp)->next)
+      if((*rp)->blockno >= io.pos){
+        pick = rp;
+        break;
+      }
+    r = *pick;
+
+    // with no descriptors free on this hart's virtqueue,
+    // wait for one of the requests there to finish.
+    if(virtio_disk_rw_trystart(r->bufs, r->write) < 0)
+      break;
+    *pick = r->next;
+    io.npending--;
+    io.vtime = best->pass;
+    best->pass += best->stride * r->n;
+    io.pos = r->blockno + r->n;
+    kmem_cache_free(reqcache, r);
+  }
+}
+
+// Add r to q, in block order, merging it into a request
+// that it continues or that continues it. Caller holds io.lock.
+static void
+enqueue(struct ioq *q, struct ioreq *r)
+{
+  struct ioreq *s, **rp;
+
+  for(s = q->head; s; s = s->next){
+    if(s->write != r->write || s->n + r->n > MAXSEG)
+      continue;
+    if(s->blockno + s->n == r->blockno){
+      s->last->ionext = r->bufs;
+      s->last = r->last;
+    } else if(r->blockno + r->n == s->blockno){
+      r->last->ionext = s->bufs;
+      s->bufs = r->bufs;
+      s->blockno = r->blockno;
+    } else
+      continue;
+    s->n += r->n;
+    io.nmerge++;
+    kmem_cache_free(reqcache, r);
+    return;
+  }
+
+  for(rp = &q->head; *rp && (*rp)->blockno < r->blockno; rp = &(*rp)->next)
+    ;
+  r->next = *rp;
+  *rp = r;
+  io.npending++;
+}
+
+// Have the disk read or write the n buffers bufs[], which
+// hold consecutive blocks, without waiting for it; each
+// b->disk is set until it is done (see iosched_wait()).
+void
+iosched_submit(struct buf **bufs, int n, int write)
+{
+  struct proc *p = myproc();
+  struct ioq *q = &io.q[p ? p - proc : NPROC];
+  int tickets = p ? p->tickets : 1;
+  struct ioreq *r;
+  int i, k, m;
+
+  if(tickets < 1)
+    tickets = 1;
+
+  for(i = 0; i < n; i += m){
+    m = n - i < MAXSEG ? n - i : MAXSEG;
+    if((r = kmem_cache_alloc(reqcache)) == 0)
+      panic("iosched_submit");
+    r->bufs = bufs[i];
+    r->last = bufs[i + m - 1];
+    r->blockno = bufs[i]->blockno;
+    r->n = m;
+    r->write = write;
+
+    acquire(&io.lock);
+    for(k = i; k < i + m; k++){
+      bufs[k]->disk = 1;
+      bufs[k]->ionext = k + 1 < i + m ? bufs[k+1] : 0;
+    }
+    q->stride = STRIDE1 / tickets;
+    if(q->head == 0 && q->pass < io.vtime)
+      q->pass = io.vtime;     // no credit for time spent idle
+    enqueue(q, r);
+    dispatch();
+    if(io.npending > 0)
+      io.nqueued++;           // the disk is full
+    release(&io.lock);
+  }
+}
+
+// The disk has finished the requests whose buffers are
+// on the list done, by b->ionext. From virtio_disk.c,
+// perhaps in an interrupt.
+void
+iosched_done(struct buf *done)
+{
+  struct buf *b, *next;
+
+  acquire(&io.lock);
+  for(b = done; b; b = next){
+    next = b->ionext;
+    b->disk = 0;
+    wakeup(&b->disk);
+  }
+  dispatch();
+  release(&io.lock);
+}
+
+// Wait for the disk to finish with b. sync says someone is
+// waiting on it, as for a log commit, and so it may poll
+// (see virtio_disk_poll()).
+void
+iosched_wait(struct buf *b, int sync)
+{
+  virtio_disk_rw_poll(&b->disk, sync);
+
+  acquire(&io.lock);
+  while(b->disk)
+    sleep(&b->disk, &io.lock);
+  release(&io.lock);
+}
+
+// copy the scheduler's counts into *st.
+void
+ioschedstat(struct memstat *st)
+{
+  acquire(&io.lock);
+  st->iomerge = io.nmerge;
+  st->ioqueued = io.nqueued;
+  release(&io.lock);
+}
@@ -1,6 +1,30 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// A buddy allocator: free memory is kept as blocks of
+// 2^order contiguous pages, one free list per order. An
+// allocation of order k takes the smallest free block of
+// order >= k and splits it in halves until it is the right
+// size; the unused halves go back on the lower free lists.
+// When a block is freed, it is merged with its buddy (the
+// other half of the block it was split from) for as long
+// as the buddy is also free.
+//
+// kalloc() is the common order-0 case, and takes a page
+// straight off the order-0 list when there is one, without
+// searching the larger orders.
+//
+// Order-0 pages are reference counted, so that a page can be
+// mapped by several processes (see pagecache.c). kalloc()
+// returns a page with one reference, kdup() adds one, and
+// kfree() drops one, freeing the page with the last.
+//
+// When no block is free, kalloc() and kalloc_order() call
+// the shrinkers registered with kshrinker(), which give back
+// memory held in caches (e.g. the slab allocator's), and try
+// once more. A shrinker may acquire its own locks, so those
+// locks must never be held across a call to kalloc().
 
 #include "types.h"
 #include "param.h"
@@ -8,25 +32,76 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "memstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// one entry per physical page from KERNBASE to PHYSTOP.
+#define NPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define IDX2PA(i) (KERNBASE + (uint64)(i) * PGSIZE)
+
+// pginfo[] holds the order of the block starting at a page,
+// or'd with PG_FREE if the block is on a free list.
+#define PG_FREE  0x80
+
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run freelist[MAXORDER+1]; // circular lists, one per order
+  uchar pginfo[NPAGES];
+  ushort pgref[NPAGES];  // references to each allocated order-0 page
+  struct memstat st;
 } kmem;
 
+#define NSHRINKER 4
+static int (*shrinkers[NSHRINKER])(void);
+static int nshrinker;
+
+// Blocks held by the buddytest() system call, so that
+// a user program can drive a randomized allocation
+// workload without ever seeing a physical address.
+// Each belongs to the process that allocated it, and
+// exit() frees those it still holds.
+static struct {
+  struct spinlock lock;
+  void *pa[NBTSLOT];
+  int order[NBTSLOT];
+  int pid[NBTSLOT];
+} btest;
+
+static void
+list_push(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+list_remove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&btest.lock, "btest");
+  for(int k = 0; k <= MAXORDER; k++){
+    kmem.freelist[k].next = &kmem.freelist[k];
+    kmem.freelist[k].prev = &kmem.freelist[k];
+  }
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +110,204 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.st.npages++;
+    kmem.pgref[PA2IDX(p)] = 1;
     kfree(p);
+  }
+}
+
+// Put the block of order at idx on the free lists,
+// merging it with its buddy as far as possible.
+// Caller must hold kmem.lock.
+static void
+buddy_free(uint64 idx, int order)
+{
+  kmem.st.nfree += 1L << order;
+  while(order < MAXORDER){
+    uint64 bidx = idx ^ (1L << order);
+    if(bidx >= NPAGES || kmem.pginfo[bidx] != (PG_FREE | order))
+      break;
+    // buddy is free and whole: take it off its list and merge.
+    list_remove((struct run*)IDX2PA(bidx));
+    kmem.st.nblocks[order]--;
+    kmem.pginfo[bidx] = 0;
+    kmem.st.nmerge++;
+    idx &= ~(1L << order);
+    order++;
+  }
+  kmem.pginfo[idx] = PG_FREE | order;
+  list_push(&kmem.freelist[order], (struct run*)IDX2PA(idx));
+  kmem.st.nblocks[order]++;
+}
+
+// Take a block of the given order off the free lists,
+// splitting a larger block if need be.
+// Returns 0 if there is no block large enough.
+// Caller must hold kmem.lock.
+static struct run *
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.freelist[k].next != &kmem.freelist[k])
+      break;
+  if(k > MAXORDER){
+    kmem.st.nfail++;
+    return 0;
+  }
+
+  r = kmem.freelist[k].next;
+  list_remove(r);
+  kmem.st.nblocks[k]--;
+
+  // split, returning the upper halves to the free lists.
+  while(k > order){
+    k--;
+    uint64 bidx = PA2IDX(r) + (1L << k);
+    kmem.pginfo[bidx] = PG_FREE | k;
+    list_push(&kmem.freelist[k], (struct run*)IDX2PA(bidx));
+    kmem.st.nblocks[k]++;
+    kmem.st.nsplit++;
+  }
+
+  kmem.pginfo[PA2IDX(r)] = order;
+  kmem.pgref[PA2IDX(r)] = 1;
+  kmem.st.nfree -= 1L << order;
+  kmem.st.nalloc[order]++;
+  return r;
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Register fn to be called when physical memory runs out.
+// fn should free what memory it can and return the number
+// of blocks it freed. Only called during boot.
 void
-kfree(void *pa)
+kshrinker(int (*fn)(void))
+{
+  if(nshrinker >= NSHRINKER)
+    panic("kshrinker");
+  shrinkers[nshrinker++] = fn;
+}
+
+// Ask every shrinker to give memory back, the last registered
+// first: caches registered after the slab allocator's may free
+// objects into it, which its own shrinker then gives back.
+// Returns the number of blocks they freed.
+static int
+kshrink(void)
+{
+  int n = 0;
+  for(int i = nshrinker - 1; i >= 0; i--)
+    n += shrinkers[i]();
+  return n;
+}
+
+// Free the block of 2^order pages of physical memory
+// pointed at by pa, which must have been returned by
+// kalloc_order() with the same order.
+void
+kfree_order(void *pa, int order)
+{
+  uint64 sz = (uint64)PGSIZE << order;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kfree_order: order");
+  if(((uint64)pa % sz) != 0 || (char*)pa < end || (uint64)pa + sz > PHYSTOP)
+    panic("kfree_order");
+
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, sz);
+
+  acquire(&kmem.lock);
+  if(kmem.pginfo[PA2IDX(pa)] != order)
+    panic("kfree_order: not allocated with this order");
+  kmem.pgref[PA2IDX(pa)] = 0;
+  buddy_free(PA2IDX(pa), order);
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_order(int order)
 {
   struct run *r;
 
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  r = buddy_alloc(order);
+  release(&kmem.lock);
+
+  if(r == 0 && kshrink() > 0){
+    acquire(&kmem.lock);
+    r = buddy_alloc(order);
+    release(&kmem.lock);
+  }
+
+  if(r)
+    memset((char*)r, 5, (uint64)PGSIZE << order); // fill with junk
+  return (void*)r;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last.
+// (The exception is when initializing the allocator;
+// see kinit above.)
+void
+kfree(void *pa)
+{
+  uint64 idx = PA2IDX(pa);
+
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.pginfo[idx] != 0 || kmem.pgref[idx] == 0)
+    panic("kfree: not an allocated order-0 page");
+  if(--kmem.pgref[idx] > 0){
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
-  r = (struct run*)pa;
+  acquire(&kmem.lock);
+  buddy_free(idx, 0);
+  release(&kmem.lock);
+}
+
+// Add a reference to the page pa, which was
+// returned by kalloc().
+void
+kdup(void *pa)
+{
+  uint64 idx = PA2IDX(pa);
+
+  acquire(&kmem.lock);
+  if(kmem.pginfo[idx] != 0 || kmem.pgref[idx] == 0)
+    panic("kdup");
+  kmem.pgref[idx]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to the page pa.
+int
+krefs(void *pa)
+{
+  int n;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  n = kmem.pgref[PA2IDX(pa)];
   release(&kmem.lock);
+  return n;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -71,12 +319,139 @@ kalloc(void)
   struct run *r;
 
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = kmem.freelist[0].next;
+  if(r != &kmem.freelist[0]){
+    list_remove(r);
+    kmem.pginfo[PA2IDX(r)] = 0;
+    kmem.pgref[PA2IDX(r)] = 1;
+    kmem.st.nblocks[0]--;
+    kmem.st.nfree--;
+    kmem.st.nalloc[0]++;
+  } else {
+    r = buddy_alloc(0);
+  }
   release(&kmem.lock);
 
+  if(r == 0 && kshrink() > 0){
+    acquire(&kmem.lock);
+    r = buddy_alloc(0);
+    release(&kmem.lock);
+  }
+
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Return the number of free pages. Read without the
+// lock, so only a hint.
+uint64
+kfreepages(void)
+{
+  return __atomic_load_n(&kmem.st.nfree, __ATOMIC_RELAXED);
+}
+
+// Copy the allocator's statistics into *st.
+void
+kmemstat(struct memstat *st)
+{
+  acquire(&kmem.lock);
+  *st = kmem.st;
+  release(&kmem.lock);
+}
+
+// Check that every page of the block pa of the given
+// order still holds slot i's fill pattern, i.e. that no
+// other allocation overlapped it.
+static int
+btest_check(int i, char *pa, int order)
+{
+  uint64 sz = (uint64)PGSIZE << order;
+
+  for(uint64 off = 0; off < sz; off += PGSIZE)
+    if(pa[off] != (char)i || pa[off + PGSIZE - 1] != (char)i)
+      return -1;
+  return 0;
+}
+
+// Check and free the block in slot i, which the caller holds, and
+// give the slot back. The block is checked and freed without
+// btest.lock: no other process touches a slot it holds.
+static int
+btest_free(int i)
+{
+  int r;
+
+  r = btest_check(i, btest.pa[i], btest.order[i]);
+  kfree_order(btest.pa[i], btest.order[i]);
+  acquire(&btest.lock);
+  btest.pa[i] = 0;
+  btest.pid[i] = 0;
+  release(&btest.lock);
+  return r;
+}
+
+// Carry out one buddytest() operation for the process
+// with the given pid; see memstat.h. BT_ALLOC returns the slot holding
+// the new block, BT_FREE returns 0, or -1 if the block had
+// been overwritten. All return -1 on bad arguments, and
+// BT_FREE on a slot the process does not hold.
+// A slot is held while btest.pid[] is set; btest.lock only
+// covers taking and giving back slots, so that kalloc_order(),
+// which may run the shrinkers, and the fill and check of
+// blocks of up to PGSIZE<<MAXORDER bytes run without it.
+int
+kalloctest(int pid, int op, int arg)
+{
+  int i, r = 0;
+  void *pa;
+
+  switch(op){
+  case BT_ALLOC:
+    acquire(&btest.lock);
+    for(i = 0; i < NBTSLOT; i++)
+      if(btest.pid[i] == 0)
+        break;
+    if(i == NBTSLOT){
+      release(&btest.lock);
+      return -1;
+    }
+    btest.pid[i] = pid;
+    release(&btest.lock);
+
+    if((pa = kalloc_order(arg)) == 0){
+      acquire(&btest.lock);
+      btest.pid[i] = 0;
+      release(&btest.lock);
+      return -1;
+    }
+    memset(pa, i, (uint64)PGSIZE << arg);
+
+    acquire(&btest.lock);
+    btest.order[i] = arg;
+    btest.pa[i] = pa;
+    release(&btest.lock);
+    return i;
+
+  case BT_FREE:
+    if(arg < 0 || arg >= NBTSLOT)
+      return -1;
+    acquire(&btest.lock);
+    r = btest.pa[arg] != 0 && btest.pid[arg] == pid;
+    release(&btest.lock);
+    if(!r)
+      return -1;
+    return btest_free(arg);
+
+  case BT_RESET:
+    for(i = 0; i < NBTSLOT; i++){
+      acquire(&btest.lock);
+      pa = btest.pid[i] == pid ? btest.pa[i] : 0;
+      release(&btest.lock);
+      if(pa && btest_free(i) < 0)
+        r = -1;
+    }
+    return r;
+  }
+  return -1;
+}
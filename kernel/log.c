@@ -62,24 +62,35 @@ initlog(int dev, struct superblock *sb)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// The log blocks come from the disk in one request, and the
+// home blocks go back sorted, so that runs of consecutive
+// blocks (as a large write() makes) go in one request each.
 static void
 install_trans(int recovering)
 {
-  int tail;
+  struct buf *lbuf[LOGBLOCKS], *dbuf[LOGBLOCKS], *b;
+  int tail, i;
 
+  breadv(log.dev, log.start+1, log.lh.n, lbuf); // read log blocks
   for (tail = 0; tail < log.lh.n; tail++) {
     if(recovering) {
       printf("recovering tail %d dst %d\n", tail, log.lh.block[tail]);
     }
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    b = bread(log.dev, log.lh.block[tail]); // read dst
+    bwait(lbuf[tail]);
+    memmove(b->data, lbuf[tail]->data, BSIZE);  // copy block to dst
+    brelse(lbuf[tail]);
+    for(i = tail; i > 0 && dbuf[i-1]->blockno > b->blockno; i--)
+      dbuf[i] = dbuf[i-1];
+    dbuf[i] = b;
+  }
+  bwritev(dbuf, log.lh.n);  // write dsts to disk
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(dbuf[tail]);
     if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      bunpin(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -110,7 +121,7 @@ write_head(void)
   for (i = 0; i < log.lh.n; i++) {
     hb->block[i] = log.lh.block[i];
   }
-  bwrite(buf);
+  bsync(buf);
   brelse(buf);
 }
 
@@ -175,19 +186,25 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to log, which is
+// contiguous on the disk, so one request writes it all.
 static void
 write_log(void)
 {
+  struct buf *to[LOGBLOCKS];
   int tail;
 
+  breadv(log.dev, log.start+1, log.lh.n, to); // log blocks
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    bwait(to[tail]);
+    memmove(to[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
+  }
+  bwritev(to, log.lh.n);  // write the log
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(to[tail]);
+    brelse(to[tail]);
   }
 }
 
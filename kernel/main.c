@@ -17,18 +17,27 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    stringinit();    // cbo.zero for memset()
+    slabinit();      // small-object allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space identifiers
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    ioschedinit();   // disk request scheduler
     iinit();         // inode table
+    pcacheinit();    // file page cache
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    shminit();       // shared memory segments
     virtio_disk_init(); // emulated hard disk
+    swapinit();      // swap space on the second disk
     userinit();      // first user process
+    zswapinit();     // compressed swap and the kswapd process
     __sync_synchronize();
     started = 1;
   } else {
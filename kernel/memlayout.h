@@ -24,6 +24,9 @@
 // virtio mmio interface
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+// a second virtio disk, for swap
+#define VIRTIO1 0x10002000
+#define VIRTIO1_IRQ 2
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -54,6 +57,17 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap regions, allocated downwards from MMAPTOP
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define MMAPTOP TRAPFRAME
+
+// while copying to and from user memory, the kernel reaches
+// user address va at UWIN + va, in the upper half of the
+// address space, which the kernel's own mappings leave unused
+// (see uwinopen() in vm.c). the window stops at UWINTOP, short
+// of the top gigabyte, which holds the trapframes: they are
+// not PTE_U, which would not keep the kernel from them.
+#define UWIN (-MAXVA)
+#define UWINTOP (MAXVA - (1L << 30))
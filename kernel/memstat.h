@@ -0,0 +1,82 @@
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+// The buddy allocator in kalloc.c hands out blocks of
+// 2^order pages, for order 0 through MAXORDER.
+#define MAXORDER 10   // largest block is 2^10 pages (4 MB)
+
+// Per-cache statistics for the slab allocator in slab.c.
+#define NSLABCACHE 20  // maximum number of slab caches
+struct slabinfo {
+  char name[16];
+  uint objsize;                  // bytes per object, after rounding
+  uint perslab;                  // objects per slab
+  uint slabsize;                 // bytes per slab
+  uint nslabs;                   // slabs allocated
+  uint64 nactive;                // objects in use or in per-CPU arrays
+  uint64 nalloc;                 // allocations since boot
+};
+
+// Physical memory statistics, filled in by kmemstat(), slabstat(),
+// pcachestat(), zswapstat(), swapstat(), bcachestat() and
+// virtio_disk_stat(), and copied out to user space by the
+// memstat() system call.
+struct memstat {
+  uint64 npages;                 // pages managed by the allocator
+  uint64 nfree;                  // pages currently free
+  uint64 nblocks[MAXORDER+1];    // free blocks of each order
+  uint64 nalloc[MAXORDER+1];     // allocations of each order since boot
+  uint64 nsplit;                 // blocks split to satisfy an allocation
+  uint64 nmerge;                 // buddies coalesced on free
+  uint64 nfail;                  // allocations that found no block
+  uint64 npcache;                // pages in the page cache
+  uint64 pchit;                  // page faults served from the page cache
+  uint64 pcmiss;                 // read-only page faults that read the file
+  uint64 nzswap;                 // pages held compressed by zswap
+  uint64 zsbytes;                // bytes of slab they take up
+  uint64 zsout;                  // pages compressed since boot
+  uint64 zsin;                   // pages decompressed since boot
+  uint64 nswapslots;             // pages the swap disk holds, or 0 if none
+  uint64 nswap;                  // pages on the swap disk
+  uint64 swout;                  // pages written to the swap disk since boot
+  uint64 swin;                   // pages read back since boot
+  uint64 nbuf;                   // buffers in the disk block cache
+  uint64 bhit;                   // bread()s that found the block cached
+  uint64 bmiss;                  // bread()s that did not
+  uint64 bmhit;                  // bread() hits on log, inode, bitmap and directory blocks
+  uint64 bmmiss;                 // and misses
+  uint64 nbufa1;                 // buffers on the A1in queue (see bio.c)
+  uint64 bevict;                 // buffers reused for another block
+  uint64 bghosthit;              // misses on blocks recently on A1in
+  uint64 bpinned;                // buffers pinned by the log
+  uint64 bahead;                 // blocks read ahead (see readahead() in fs.c)
+  uint64 baheadhit;              // of those, later bread()
+  uint64 breq;                   // disk requests for the buffer cache
+  uint64 breqblk;                // blocks they moved
+  uint64 dintr;                  // file system disk interrupts
+  uint64 dnotify;                // notifications the driver sent it
+  uint64 dpoll;                  // polls that found requests done
+  int dnq;                       // its virtqueues (one per hart, at most)
+  uint64 iomerge;                // requests merged into others (see iosched.c)
+  uint64 ioqueued;               // requests submitted with the disk full
+  int nslab;                     // slab caches in use
+  struct slabinfo slab[NSLABCACHE];
+};
+
+// what zswapctl() lets reclaim do with cold pages.
+#define ZSWAP_COMPRESS 1  // keep them compressed in memory
+#define ZSWAP_DISK     2  // write them to the swap disk
+
+// which waits for the disk diskpoll() has spin on the
+// virtqueue for a while before sleeping.
+#define DISKPOLL_OFF  0   // none: sleep until the interrupt
+#define DISKPOLL_SYNC 1   // those someone is waiting on: log commits
+#define DISKPOLL_ALL  2   // every one
+
+// operations for the buddytest() system call.
+#define BT_ALLOC  0   // allocate a block of order arg, returns a slot
+#define BT_FREE   1   // check and free the block in slot arg
+#define BT_RESET  2   // free every block the caller still holds
+#define NBTSLOT 128   // blocks all callers may hold at once
+
+#endif // _MEMSTAT_H_
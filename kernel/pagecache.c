@@ -0,0 +1,304 @@
+//
+// Cache of file pages, so that processes running the same
+// program share one copy of its text, and processes mapping
+// a file with MAP_SHARED share one copy of each of its pages.
+//
+// When a process faults on a page of a read-only region backed
+// by a file (see vma.c), the page is looked up here by inode and
+// file offset, and if present the cached page is mapped directly.
+// Otherwise the page is read from the file as usual and added
+// to the cache. The cache holds its own reference to each page
+// (see kdup() in kalloc.c), so a page outlives the processes
+// that map it as long as its inode is in the inode table.
+// These read-only pages of an inode are dropped when the file
+// is written or truncated; processes that already map a dropped
+// page keep it.
+//
+// Pages of MAP_SHARED regions are kept apart, one per inode
+// and page-aligned offset, from pcache_shared(). They are not
+// dropped while mapped: writei() copies what it writes into
+// them, and itrunc() zeroes them, so every mapping sees the
+// file as it is. What processes store into them reaches the
+// file when they are unmapped (see vma_writeback()).
+//
+// All the pages of an inode are dropped when it leaves the
+// inode table. When memory runs out, pages mapped by no
+// process are freed.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define NPCHASH 61
+
+struct cpage {
+  struct cpage *next;   // hash chain
+  struct inode *ip;
+  uint off;             // file offset of the page
+  uint n;               // bytes of file data; the rest is zero
+  int shared;           // page of MAP_SHARED regions
+  void *pa;
+};
+
+// pcache.lock protects the hash chains and ip->npcache.
+// It must not be held across a call to kalloc().
+static struct {
+  struct spinlock lock;
+  struct cpage *hash[NPCHASH];
+  uint64 npages;
+  uint64 nhit;
+  uint64 nmiss;
+} pcache;
+
+static struct kmem_cache *cpagecache;
+
+static int pcache_shrink(void);
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  cpagecache = kmem_cache_create("cpage", sizeof(struct cpage), 0);
+  kshrinker(pcache_shrink);
+}
+
+static struct cpage**
+pcache_bucket(struct inode *ip, uint off)
+{
+  return &pcache.hash[((uint64)ip / sizeof(*ip) + off / PGSIZE) % NPCHASH];
+}
+
+// Return the cached page holding n bytes of ip from off,
+// with a reference added for the caller, or 0.
+// Caller must hold ip->lock.
+void*
+pcache_get(struct inode *ip, uint off, uint n)
+{
+  struct cpage *c;
+  void *pa = 0;
+
+  acquire(&pcache.lock);
+  for(c = *pcache_bucket(ip, off); c; c = c->next){
+    if(c->ip == ip && c->off == off && c->n == n && !c->shared){
+      kdup(c->pa);
+      pa = c->pa;
+      break;
+    }
+  }
+  if(pa)
+    pcache.nhit++;
+  else
+    pcache.nmiss++;
+  release(&pcache.lock);
+  return pa;
+}
+
+// Add pa, holding n bytes of ip from off, to the cache.
+// Returns 0, or -1 if out of memory.
+// Caller must hold ip->lock.
+static int
+pcache_add(struct inode *ip, uint off, uint n, int shared, void *pa)
+{
+  struct cpage *c, **b;
+
+  if((c = kmem_cache_alloc(cpagecache)) == 0)
+    return -1;
+  c->ip = ip;
+  c->off = off;
+  c->n = n;
+  c->shared = shared;
+  c->pa = pa;
+
+  acquire(&pcache.lock);
+  b = pcache_bucket(ip, off);
+  c->next = *b;
+  *b = c;
+  ip->npcache++;
+  pcache.npages++;
+  kdup(pa);
+  release(&pcache.lock);
+  return 0;
+}
+
+// Add read-only page pa, holding n bytes of ip from off,
+// to the cache. Caller must hold ip->lock.
+void
+pcache_put(struct inode *ip, uint off, uint n, void *pa)
+{
+  pcache_add(ip, off, n, 0, pa);
+}
+
+// Return the page that all MAP_SHARED regions map for
+// the page of ip at off, reading it in if it is not cached,
+// with a reference added for the caller. Returns 0 if out
+// of memory or the file could not be read.
+// Caller must hold ip->lock.
+void*
+pcache_shared(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  void *pa = 0;
+  uint n = 0;
+
+  acquire(&pcache.lock);
+  for(c = *pcache_bucket(ip, off); c; c = c->next){
+    if(c->ip == ip && c->off == off && c->shared){
+      kdup(c->pa);
+      pa = c->pa;
+      break;
+    }
+  }
+  if(pa)
+    pcache.nhit++;
+  else
+    pcache.nmiss++;
+  release(&pcache.lock);
+  if(pa)
+    return pa;
+
+  // no one else can add this page, since they
+  // would need ip->lock.
+  if((pa = kalloc()) == 0)
+    return 0;
+  memset(pa, 0, PGSIZE);
+  if(ip->size > off)
+    n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+  if(readi(ip, 0, (uint64)pa, off, n) != n ||
+     pcache_add(ip, off, n, 1, pa) < 0){
+    kfree(pa);
+    return 0;
+  }
+  return pa;
+}
+
+// Copy n bytes just written to ip at off from src into the
+// MAP_SHARED pages that hold them, for writei().
+// Caller must hold ip->lock.
+void
+pcache_write(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *c;
+  uint pgoff, m;
+
+  acquire(&pcache.lock);
+  for(; n > 0; off += m, src += m, n -= m){
+    pgoff = off % PGSIZE;
+    m = n < PGSIZE - pgoff ? n : PGSIZE - pgoff;
+    for(c = *pcache_bucket(ip, off - pgoff); c; c = c->next){
+      if(c->ip == ip && c->off == off - pgoff && c->shared){
+        memmove((char*)c->pa + pgoff, src, m);
+        break;
+      }
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Drop the cache entry *cp, and its reference to the page.
+// Caller must hold pcache.lock.
+static void
+pcache_remove(struct cpage **cp)
+{
+  struct cpage *c = *cp;
+
+  *cp = c->next;
+  c->ip->npcache--;
+  pcache.npages--;
+  kfree(c->pa);
+  kmem_cache_free(cpagecache, c);
+}
+
+// Drop ip's read-only pages, and its MAP_SHARED pages
+// too if all is set.
+static void
+pcache_drop(struct inode *ip, int all)
+{
+  struct cpage **cp;
+
+  acquire(&pcache.lock);
+  for(int i = 0; i < NPCHASH && ip->npcache > 0; i++){
+    for(cp = &pcache.hash[i]; *cp; ){
+      if((*cp)->ip == ip && (all || !(*cp)->shared))
+        pcache_remove(cp);
+      else
+        cp = &(*cp)->next;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Drop ip's read-only pages, because ip's contents are
+// changing. Its MAP_SHARED pages are kept up to date
+// instead, by pcache_write().
+void
+pcache_inval(struct inode *ip)
+{
+  pcache_drop(ip, 0);
+}
+
+// Drop ip's read-only pages and zero its MAP_SHARED
+// pages, because ip is being truncated.
+// Caller must hold ip->lock.
+void
+pcache_trunc(struct inode *ip)
+{
+  struct cpage *c;
+
+  pcache_drop(ip, 0);
+  acquire(&pcache.lock);
+  for(int i = 0; i < NPCHASH && ip->npcache > 0; i++)
+    for(c = pcache.hash[i]; c; c = c->next)
+      if(c->ip == ip)
+        memset(c->pa, 0, PGSIZE);
+  release(&pcache.lock);
+}
+
+// Drop all of ip's pages, because ip is leaving the
+// inode table. No region maps ip, since each holds a
+// reference to it.
+void
+pcache_evict(struct inode *ip)
+{
+  pcache_drop(ip, 1);
+}
+
+// Free the cached pages that no process maps.
+// Called by kalloc when memory runs out.
+static int
+pcache_shrink(void)
+{
+  struct cpage **cp;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(int i = 0; i < NPCHASH; i++){
+    for(cp = &pcache.hash[i]; *cp; ){
+      if(krefs((*cp)->pa) == 1){
+        pcache_remove(cp);
+        n++;
+      } else
+        cp = &(*cp)->next;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// Fill in the page cache part of a struct memstat.
+void
+pcachestat(struct memstat *st)
+{
+  acquire(&pcache.lock);
+  st->npcache = pcache.npages;
+  st->pchit = pcache.nhit;
+  st->pcmiss = pcache.nmiss;
+  release(&pcache.lock);
+}
@@ -2,14 +2,18 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // maximum number of cached unused i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // least size of disk block cache
+#define NBUFMAX      2048  // most the disk block cache grows to
+#define FSSIZE       10000 // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
-#define USERSTACK    1     // user stack pages
+#define USERSTACK    1     // user stack pages mapped by exec
+#define USERSTACKMAX 1024  // pages a user stack may grow to (4 MB)
+#define NSYSCALL     64    // size of per-process syscall count table
+#define NVMA         16    // demand-filled regions per process
 
@@ -3,9 +3,9 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 
 #define PIPESIZE 512
@@ -19,6 +19,21 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+// pipes come from a slab cache rather than a page each.
+static struct kmem_cache *pipecache;
+
+static void
+pipector(void *p)
+{
+  initlock(&((struct pipe*)p)->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +43,12 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +61,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,46 +82,65 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Data moves between user memory and the pipe through a buffer
+// on the kernel stack, a chunk at a time, so that copyin() and
+// copyout() run without pi->lock: a page fault there may sleep.
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, k, m, c;
   struct proc *pr = myproc();
+  char buf[PIPESIZE];
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || killed(pr)){
-      release(&pi->lock);
-      return -1;
-    }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+    m = n - i;
+    if(m > PIPESIZE)
+      m = PIPESIZE;
+    if(copyin(pr->vm->pagetable, buf, addr + i, m) == -1)
+      break;
+
+    acquire(&pi->lock);
+    for(k = 0; k < m; ){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
+        continue;
+      }
+      // as much as fits before the end of data[].
+      c = m - k;
+      if(c > pi->nread + PIPESIZE - pi->nwrite)
+        c = pi->nread + PIPESIZE - pi->nwrite;
+      if(c > PIPESIZE - pi->nwrite % PIPESIZE)
+        c = PIPESIZE - pi->nwrite % PIPESIZE;
+      memmove(&pi->data[pi->nwrite % PIPESIZE], buf + k, c);
+      pi->nwrite += c;
+      k += c;
     }
+    wakeup(&pi->nread);
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
 
+// A read into a bad address loses the bytes it took.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, c;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPESIZE];
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -117,18 +150,21 @@ piperead(struct pipe *pi, uint64 addr, int n)
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1) {
-      if(i == 0)
-        i = -1;
-      break;
-    }
-    pi->nread++;
+  if(n > PIPESIZE)
+    n = PIPESIZE;
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += c){  //DOC: piperead-copy
+    c = n - i;
+    if(c > pi->nwrite - pi->nread)
+      c = pi->nwrite - pi->nread;
+    if(c > PIPESIZE - pi->nread % PIPESIZE)
+      c = PIPESIZE - pi->nread % PIPESIZE;
+    memmove(buf + i, &pi->data[pi->nread % PIPESIZE], c);
+    pi->nread += c;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
+
+  if(i > 0 && copyout(pr->vm->pagetable, addr, buf, i) == -1)
+    return -1;
   return i;
 }
@@ -3,8 +3,10 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
+#include "memstat.h"
 
 struct cpu cpus[NCPU];
 
@@ -26,6 +28,12 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// protects the futex words that waiters sleep on.
+struct spinlock futex_lock;
+
+static struct kmem_cache *vmcache;     // struct vmspace
+static struct kmem_cache *filescache;  // struct filetable
+
 // LOTTERY SCHEDULER: Seed for random number generator
 // This value changes with each random() call to generate new random numbers
 unsigned long random_seed = 1;
@@ -55,6 +63,9 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  initlock(&futex_lock, "futex");
+  vmcache = kmem_cache_create("vmspace", sizeof(struct vmspace), 0);
+  filescache = kmem_cache_create("filetable", sizeof(struct filetable), 0);
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -140,7 +151,7 @@ found:
   
   // SYSTEM CALL TRACING: Initialize syscall counters
   // Set all syscall counts to 0 when process is created
-  for(int i = 0; i < 25; i++) {
+  for(int i = 0; i < NSYSCALL; i++) {
     p->syscall_count[i] = 0;
   }
   
@@ -153,14 +164,6 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -179,10 +182,9 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+  if(p->vm)
+    vmspace_free(p->vm);
+  p->vm = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -236,6 +238,115 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
   uvmfree(pagetable, sz);
 }
 
+// Make an empty address space, with p's trapframe mapped
+// at TRAPFRAME. Returns it, or 0 if out of memory.
+struct vmspace*
+vmspace_alloc(struct proc *p)
+{
+  struct vmspace *vm;
+
+  if((vm = kmem_cache_alloc(vmcache)) == 0)
+    return 0;
+  memset(vm, 0, sizeof(*vm));
+  initsleeplock(&vm->lock, "vmspace");
+  vm->ref = 1;
+  if((vm->pagetable = proc_pagetable(p)) == 0){
+    kmem_cache_free(vmcache, vm);
+    return 0;
+  }
+  return vm;
+}
+
+// Free an address space that has no regions left.
+void
+vmspace_free(struct vmspace *vm)
+{
+  proc_freepagetable(vm->pagetable, vm->sz);
+  kmem_cache_free(vmcache, vm);
+}
+
+// Drop p's reference to its address space, for exit()
+// and exec(). The last thread to go releases it; the
+// others just take away p's trapframe.
+// Returns 0, or -1 if dirty pages of mapped files could
+// not be written back.
+// zswap.c finds address spaces through p->vm, so it
+// is cleared with p->lock held, before the last
+// thread frees the address space.
+int
+vmspace_put(struct proc *p)
+{
+  struct vmspace *vm = p->vm;
+  struct vma *v;
+  int last, r = 0;
+
+  acquiresleep(&vm->lock);
+  last = --vm->ref == 0;
+  if(!last){
+    uvmunmap(vm->pagetable, p->tfva, 1, 0);
+    if(p->tfva != TRAPFRAME && (v = vma_find(p, p->tfva)) != 0)
+      memset(v, 0, sizeof(*v));
+    acquire(&p->lock);
+    p->vm = 0;
+    release(&p->lock);
+  }
+  releasesleep(&vm->lock);
+
+  if(last){
+    if(vma_release(p) < 0){
+      printf("pid %d %s: lost writes to a mapped file\n", p->pid, p->name);
+      r = -1;
+    }
+    acquire(&p->lock);
+    p->vm = 0;
+    release(&p->lock);
+    zswap_forget(vm);
+    vmspace_free(vm);
+  }
+  return r;
+}
+
+// Make an empty table of open files.
+static struct filetable*
+filetable_alloc(void)
+{
+  struct filetable *ft;
+
+  if((ft = kmem_cache_alloc(filescache)) == 0)
+    return 0;
+  memset(ft, 0, sizeof(*ft));
+  initlock(&ft->lock, "filetable");
+  ft->ref = 1;
+  return ft;
+}
+
+// Drop p's reference to its open files; the last
+// thread to go closes them.
+static void
+filetable_put(struct proc *p)
+{
+  struct filetable *ft = p->files;
+  int last;
+
+  acquire(&ft->lock);
+  last = --ft->ref == 0;
+  release(&ft->lock);
+  p->files = 0;
+  if(!last)
+    return;
+
+  for(int fd = 0; fd < NOFILE; fd++){
+    if(ft->ofile[fd]){
+      fileclose(ft->ofile[fd]);
+      ft->ofile[fd] = 0;
+    }
+  }
+  begin_op();
+  iput(ft->cwd);
+  end_op();
+  kmem_cache_free(filescache, ft);
+}
+
 // Set up first user process.
 void
 userinit(void)
@@ -244,34 +355,56 @@ userinit(void)
 
   p = allocproc();
   initproc = p;
-  
-  p->cwd = namei("/");
+
+  if((p->vm = vmspace_alloc(p)) == 0 || (p->files = filetable_alloc()) == 0)
+    panic("userinit");
+  p->tfva = TRAPFRAME;
+  p->files->cwd = namei("/");
 
   p->state = RUNNABLE;
 
   release(&p->lock);
 }
 
+// Start a kernel process that runs fn() and never returns
+// to user space, for work that must be able to sleep, such
+// as reclaim (see zswap.c). Like forkret(), fn starts with
+// its p->lock held, and must release it.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
+// Caller must hold p->vm->lock.
 int
 growproc(int n)
 {
   uint64 sz;
   struct proc *p = myproc();
 
-  sz = p->sz;
+  sz = p->vm->sz;
   if(n > 0){
-    if(sz + n > TRAPFRAME) {
+    if(sz + n > vma_limit(p)) {
       return -1;
     }
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if((sz = uvmalloc(p->vm->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    sz = uvmdealloc(p->vm->pagetable, sz, sz + n);
+    vma_trim(p, sz);
   }
-  p->sz = sz;
+  p->vm->sz = sz;
   return 0;
 }
 
@@ -288,14 +421,26 @@ kfork(void)
   if((np = allocproc()) == 0){
     return -1;
   }
+  // np is not yet seen by wait() or the scheduler, so its
+  // lock need not be held while waiting for p's memory.
+  release(&np->lock);
+
+  if((np->vm = vmspace_alloc(np)) == 0 || (np->files = filetable_alloc()) == 0)
+    goto bad;
+  np->tfva = TRAPFRAME;
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
-    release(&np->lock);
-    return -1;
+  acquiresleep(&p->vm->lock);
+  if(uvmcopy(p->vm->pagetable, np->vm->pagetable, p->vm->sz) < 0){
+    releasesleep(&p->vm->lock);
+    goto bad;
+  }
+  np->vm->sz = p->vm->sz;
+  if(vma_dup(np, p) < 0){
+    releasesleep(&p->vm->lock);
+    goto bad;
   }
-  np->sz = p->sz;
+  releasesleep(&p->vm->lock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -309,17 +454,140 @@ kfork(void)
   np->tickets = p->tickets;
 
   // increment reference counts on open file descriptors.
+  acquire(&p->files->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+    if(p->files->ofile[i])
+      np->files->ofile[i] = filedup(p->files->ofile[i]);
+  np->files->cwd = idup(p->files->cwd);
+  release(&p->files->lock);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  if(np->files)
+    kmem_cache_free(filescache, np->files);
+  np->files = 0;
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
+// Create a thread: a process that shares p's address space,
+// open files and current directory, and starts at fn(arg) on
+// the user stack whose top is at stack. Its trapframe is
+// mapped into the shared address space as an mmap region that
+// user code cannot touch. Returns the new thread's pid.
+int
+kclone(uint64 fn, uint64 arg, uint64 stack)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+  struct vmspace *vm = p->vm;
+  uint64 va;
+  int pid;
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  release(&np->lock);
+
+  acquiresleep(&vm->lock);
+  // out of the user window (see memlayout.h).
+  va = vma_map(p, PGSIZE, PTE_R|PTE_W, VMA_TF, 0, 0, 0);
+  if(va == -1 || va < UWINTOP ||
+     mappages(vm->pagetable, va, PGSIZE, (uint64)np->trapframe, PTE_R|PTE_W) != 0){
+    if(va != -1)
+      memset(vma_find(p, va), 0, sizeof(struct vma));
+    releasesleep(&vm->lock);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  vm->ref++;
+  releasesleep(&vm->lock);
+  np->vm = vm;
+  np->tfva = va;
+
+  acquire(&p->files->lock);
+  p->files->ref++;
+  release(&p->files->lock);
+  np->files = p->files;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+
+  np->tickets = p->tickets;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a child running the program in path, as fork()
+// followed by exec() would, but without copying the caller's
+// memory only to throw it away. The child's descriptors 0, 1
+// and 2 are the caller's fd[0], fd[1] and fd[2] (none if
+// negative), and it has no others. Returns the child's pid.
+int
+kspawn(char *path, char **argv, int *fd)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+  struct filetable *ft = p->files;
+  int i, argc, pid;
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
   release(&np->lock);
 
+  if((np->files = filetable_alloc()) == 0)
+    goto bad;
+  acquire(&ft->lock);
+  np->files->cwd = idup(ft->cwd);
+  for(i = 0; i < 3; i++){
+    if(fd[i] < 0)
+      continue;
+    if(fd[i] >= NOFILE || ft->ofile[fd[i]] == 0){
+      release(&ft->lock);
+      goto bad;
+    }
+    np->files->ofile[i] = filedup(ft->ofile[fd[i]]);
+  }
+  release(&ft->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = kexec(np, path, argv)) < 0)
+    goto bad;
+  np->trapframe->a0 = argc;
+
+  np->tickets = p->tickets;
+  pid = np->pid;
+
   acquire(&wait_lock);
   np->parent = p;
   release(&wait_lock);
@@ -329,6 +597,14 @@ kfork(void)
   release(&np->lock);
 
   return pid;
+
+ bad:
+  if(np->files)
+    filetable_put(np);
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
 }
 
 // Pass p's abandoned children to init.
@@ -357,19 +633,16 @@ kexit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // Close all open files, unless other threads use them.
+  filetable_put(p);
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+  // a parent that waits for a clean exit should know
+  // if the process's stores to a mapped file were lost.
+  if(vmspace_put(p) < 0 && status == 0)
+    status = 1;
+
+  // Free any blocks held for buddytest().
+  kalloctest(p->pid, BT_RESET, 0);
 
   acquire(&wait_lock);
 
@@ -397,7 +670,7 @@ int
 kwait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -414,11 +687,18 @@ kwait(uint64 addr)
         if(pp->state == ZOMBIE){
           // Found one.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
+          if(addr != 0){
+            // copyout() may fault and sleep, so not with
+            // the locks held. only p reaps its children,
+            // so pp stays a zombie meanwhile.
+            xstate = pp->xstate;
             release(&pp->lock);
             release(&wait_lock);
-            return -1;
+            if(copyout(p->vm->pagetable, addr, (char *)&xstate,
+                       sizeof(xstate)) < 0)
+              return -1;
+            acquire(&wait_lock);
+            acquire(&pp->lock);
           }
           freeproc(pp);
           release(&pp->lock);
@@ -625,7 +905,13 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
+  // other processes may run on this hart, or
+  // this one on another, before it is done.
+  if(p->inuwin)
+    uwinclose();
   swtch(&p->context, &mycpu()->context);
+  if(p->inuwin)
+    uwinopen();
   mycpu()->intena = intena;
 }
 
@@ -664,7 +950,7 @@ forkret(void)
 
     // We can invoke kexec() now that file system is initialized.
     // Put the return value (argc) of kexec into a0.
-    p->trapframe->a0 = kexec("/init", (char *[]){ "/init", 0 });
+    p->trapframe->a0 = kexec(p, "/init", (char *[]){ "/init", 0 });
     if (p->trapframe->a0 == -1) {
       panic("exec");
     }
@@ -672,7 +958,7 @@ forkret(void)
 
   // return to user space, mimicing usertrap()'s return.
   prepare_return();
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = asid_satp(p);
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
   ((void (*)(uint64))trampoline_userret)(satp);
 }
@@ -726,6 +1012,79 @@ wakeup(void *chan)
   }
 }
 
+// Return the physical address of the futex word at user
+// address addr, faulting its page in if need be, or 0.
+// Takes a reference to the page, which the caller must
+// kfree(), so that zswap.c leaves it where it is.
+static uint64
+futex_addr(struct proc *p, uint64 addr)
+{
+  struct vmspace *vm = p->vm;
+  uint64 pa;
+
+  if(addr % sizeof(int))
+    return 0;
+  for(;;){
+    acquiresleep(&vm->lock);
+    if((pa = walkaddr(vm->pagetable, addr)) != 0)
+      kdup((void*)PGROUNDDOWN(pa));
+    releasesleep(&vm->lock);
+    if(pa)
+      return PGROUNDDOWN(pa) + (addr % PGSIZE);
+    if(vmfault(vm->pagetable, addr, PTE_R) == 0)
+      return 0;
+  }
+}
+
+// Sleep until futex_wake() on the int at user address addr,
+// if it still holds val. Waiters sleep on the word's physical
+// address, so a futex in a shm segment works between processes.
+// Returns 0 when woken, -1 if the word did not hold val.
+int
+futex_wait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  if((pa = futex_addr(p, addr)) == 0)
+    return -1;
+  acquire(&futex_lock);
+  if(*(volatile int*)pa != val){
+    release(&futex_lock);
+    kfree((void*)PGROUNDDOWN(pa));
+    return -1;
+  }
+  sleep((void*)pa, &futex_lock);
+  release(&futex_lock);
+  kfree((void*)PGROUNDDOWN(pa));
+  return 0;
+}
+
+// Wake up to n threads waiting on the int at user address addr.
+// Returns how many were woken.
+int
+futex_wake(uint64 addr, int n)
+{
+  struct proc *pp;
+  uint64 pa;
+  int woken = 0;
+
+  if((pa = futex_addr(myproc(), addr)) == 0)
+    return -1;
+  acquire(&futex_lock);
+  for(pp = proc; pp < &proc[NPROC] && woken < n; pp++){
+    acquire(&pp->lock);
+    if(pp->state == SLEEPING && pp->chan == (void*)pa){
+      pp->state = RUNNABLE;
+      woken++;
+    }
+    release(&pp->lock);
+  }
+  release(&futex_lock);
+  kfree((void*)PGROUNDDOWN(pa));
+  return woken;
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
@@ -777,7 +1136,7 @@ either_copyout(int user_dst, uint64 dst, void *src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_dst){
-    return copyout(p->pagetable, dst, src, len);
+    return copyout(p->vm->pagetable, dst, src, len);
   } else {
     memmove((char *)dst, src, len);
     return 0;
@@ -792,7 +1151,7 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
 {
   struct proc *p = myproc();
   if(user_src){
-    return copyin(p->pagetable, dst, src, len);
+    return copyin(p->vm->pagetable, dst, src, len);
   } else {
     memmove(dst, (char*)src, len);
     return 0;
@@ -24,6 +24,9 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB was flushed for
+  uint64 ntrap;               // Traps from user space (see asid_shootdown())
+  pagetable_t uwin;           // Kernel page table with a user window (see vm.c)
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +82,45 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region of user memory whose pages are filled in on
+// first touch by vmfault(), from an inode or with zeros.
+struct vma {
+  uint64 start;                // page-aligned; start == end means unused
+  uint64 end;
+  int perm;                    // PTE_R, PTE_W, PTE_X, PTE_U
+  int flags;                   // MAP_SHARED, MAP_PRIVATE (fcntl.h), VMA_MMAP
+  struct inode *ip;            // backing file, or 0 for zero-fill
+  uint off;                    // file offset of start
+  uint filesz;                 // bytes of file data from start; rest is zero
+  struct shm *shm;             // shared memory segment, for VMA_SHM
+};
+
+#define VMA_MMAP 0x100            // made by mmap(), above sz
+#define VMA_SHM  0x200            // an attached shm segment (with VMA_MMAP)
+#define VMA_TF   0x400            // a thread's trapframe (with VMA_MMAP)
+#define VMA_STACK 0x800           // the user stack, or the guard page below it
+
+// A user address space, shared by the threads of a process.
+struct vmspace {
+  struct sleeplock lock;       // held while changing the mappings
+  int ref;                     // threads using it; lock must be held
+  pagetable_t pagetable;       // User page table
+  uint64 sz;                   // Size of process memory (bytes)
+  struct vma vma[NVMA];        // demand-filled regions, e.g. ELF segments
+  uint64 asid;                 // ASID and its generation, or 0 (see asid.c)
+  int asidharts;               // Harts that have run with this ASID
+  int ncopy;                   // threads in copyin() or copyout() (see zswap.c)
+};
+
+// Open files and current directory, shared by the
+// threads of a process.
+struct filetable {
+  struct spinlock lock;
+  int ref;
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -105,7 +147,7 @@ struct proc {
   // SYSTEM CALL TRACING & COUNTING
   // Array to count how many times each syscall was made
   // Index matches syscall number (e.g., syscall_count[SYS_fork] = fork count)
-  int syscall_count[25];       // Count for each system call (max 25 syscalls)
+  int syscall_count[NSYSCALL]; // Count for each system call (max NSYSCALL syscalls)
   int trace_syscalls;          // 1 = trace enabled, 0 = disabled
 
   // wait_lock must be held when using this:
@@ -113,11 +155,12 @@ struct proc {
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  struct vmspace *vm;          // User memory, maybe shared with threads
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // user virtual address of trapframe
+  int inuwin;                  // Copying through the user window (see vm.c)
+  int nofault;                 // Copying with an inode locked (see uvmpin())
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct filetable *files;     // Open files, maybe shared with threads
   char name[16];               // Process name (debugging)
 };
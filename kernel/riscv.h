@@ -41,6 +41,9 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
+#define SSTATUS_VS (3L << 9)   // Vector unit state, 0=Off
+#define SSTATUS_VS_INITIAL (1L << 9) // Vector unit on, registers clean
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -189,7 +192,20 @@ w_stimecmp(uint64 x)
   asm volatile("csrw 0x14d, %0" : : "r" (x));
 }
 
+// Machine ISA Register, misa
+#define MISA_V (1L << ('V' - 'A'))  // vector extension
+
+static inline uint64
+r_misa()
+{
+  uint64 x;
+  asm volatile("csrr %0, misa" : "=r" (x) );
+  return x;
+}
+
 // Machine Environment Configuration Register
+#define MENVCFG_CBZE (1L << 7)  // cbo.zero allowed below M mode
+
 static inline uint64
 r_menvcfg()
 {
@@ -224,6 +240,19 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address-space identifier field of satp.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK (0xffffL << SATP_ASID_SHIFT)
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
+// supervisor scratch register; trampoline.S keeps
+// the user address of the trapframe here.
+static inline void
+w_sscratch(uint64 x)
+{
+  asm volatile("csrw sscratch, %0" : : "r" (x));
+}
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -344,6 +373,28 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries for address space asid.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entries for virtual address va
+// in address space asid.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
+// zero the cache block that holds p (Zicboz).
+static inline void
+cbo_zero(void *p)
+{
+  asm volatile(".insn i 0x0f, 2, x0, %0, 4" : : "r" (p) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
 
@@ -360,6 +411,10 @@ typedef uint64 *pagetable_t; // 512 PTEs
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty
+#define PTE_SWAP (1L << 8) // software: not valid, held by zswap.c
+#define PTE_SWAPDISK (1L << 9) // software: with PTE_SWAP, on the swap disk (swap.c)
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -0,0 +1,157 @@
+//
+// Shared memory segments.
+//
+// shmcreate(size) makes a segment of zeroed pages and returns
+// a file descriptor for it, so that a segment is handed on by
+// fork() and dup() like a pipe. shmat(fd) maps the whole segment
+// into the caller's address space as an mmap region (see vma.c)
+// and returns its address; shmdt(addr) unmaps it again.
+//
+// Each descriptor's struct file and each attachment holds a
+// reference to the segment, and the segment holds a reference
+// to each of its pages (see kdup() in kalloc.c). The segment is
+// freed when the last reference goes, e.g. when every process
+// that used it has exited.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define SHMMAX (4*1024*1024)  // largest segment, in bytes
+
+struct shm {
+  int ref;        // descriptors and attachments
+  int npages;
+  int order;      // pages[] is a block of 2^order pages
+  uint64 *pages;  // physical address of each page
+};
+
+static struct spinlock shmlock;  // protects shm->ref
+static struct kmem_cache *shmcache;
+
+void
+shminit(void)
+{
+  initlock(&shmlock, "shm");
+  shmcache = kmem_cache_create("shm", sizeof(struct shm), 0);
+}
+
+// Free a segment that has no references left.
+static void
+shmfree(struct shm *s)
+{
+  for(int i = 0; i < s->npages; i++)
+    if(s->pages[i])
+      kfree((void*)s->pages[i]);
+  kfree_order(s->pages, s->order);
+  kmem_cache_free(shmcache, s);
+}
+
+// Make a segment of size bytes and a file for it.
+// Returns 0 on success, -1 on failure.
+int
+shmalloc(uint64 size, struct file **pf)
+{
+  struct shm *s;
+  struct file *f;
+  int order = 0;
+  char *mem;
+
+  if(size == 0 || size > SHMMAX)
+    return -1;
+  if((s = kmem_cache_alloc(shmcache)) == 0)
+    return -1;
+  s->npages = PGROUNDUP(size) / PGSIZE;
+  while(((uint64)PGSIZE << order) < s->npages * sizeof(uint64))
+    order++;
+  s->order = order;
+  s->ref = 1;
+  if((s->pages = kalloc_order(order)) == 0){
+    kmem_cache_free(shmcache, s);
+    return -1;
+  }
+  memset(s->pages, 0, (uint64)PGSIZE << order);
+
+  for(int i = 0; i < s->npages; i++){
+    if((mem = kalloc()) == 0){
+      shmfree(s);
+      return -1;
+    }
+    memset(mem, 0, PGSIZE);
+    s->pages[i] = (uint64)mem;
+  }
+
+  if((f = filealloc()) == 0){
+    shmfree(s);
+    return -1;
+  }
+  f->type = FD_SHM;
+  f->readable = 0;
+  f->writable = 0;
+  f->shm = s;
+  *pf = f;
+  return 0;
+}
+
+// Add a reference to segment s.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmlock);
+  if(s->ref < 1)
+    panic("shmdup");
+  s->ref++;
+  release(&shmlock);
+}
+
+// Drop a reference to segment s, freeing it with the last.
+void
+shmput(struct shm *s)
+{
+  int ref;
+
+  acquire(&shmlock);
+  if(s->ref < 1)
+    panic("shmput");
+  ref = --s->ref;
+  release(&shmlock);
+  if(ref == 0)
+    shmfree(s);
+}
+
+// Map all of segment s into p's address space.
+// Returns its address, or -1.
+uint64
+shmattach(struct proc *p, struct shm *s)
+{
+  uint64 addr, va;
+  struct vma *v;
+
+  addr = vma_map(p, (uint64)s->npages * PGSIZE, PTE_R|PTE_W|PTE_U,
+                 MAP_SHARED|VMA_SHM, 0, 0, 0);
+  if(addr == -1)
+    return -1;
+  v = vma_find(p, addr);
+  for(int i = 0; i < s->npages; i++){
+    va = addr + (uint64)i * PGSIZE;
+    kdup((void*)s->pages[i]);
+    if(mappages(p->vm->pagetable, va, PGSIZE, s->pages[i], PTE_R|PTE_W|PTE_U|PTE_A|PTE_D) != 0){
+      kfree((void*)s->pages[i]);
+      uvmunmap(p->vm->pagetable, addr, i, 1);
+      memset(v, 0, sizeof(*v));
+      return -1;
+    }
+  }
+  shmdup(s);
+  v->shm = s;
+  return addr;
+}
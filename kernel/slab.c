@@ -0,0 +1,368 @@
+// Slab allocator for small kernel objects.
+//
+// Each kind of object (pipes, files, inodes, ...) has a cache,
+// created once by kmem_cache_create(). A cache carves blocks
+// from kalloc_order() into slabs of equal-sized objects. The
+// struct slab header sits at the start of the block, and the
+// block is aligned to its size, so the slab of an object is
+// found by rounding its address down.
+//
+// Objects are handed out in their constructed state: the
+// constructor runs once, when a slab is created, and objects
+// are expected to be returned to the cache in the same state
+// (e.g. with their locks released).
+//
+// Each CPU keeps a small array of free objects per cache, so
+// that most allocations and frees touch only that CPU's array.
+// The arrays are refilled from and flushed to the slabs in
+// batches, under the cache's lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define SLABCPU   16   // free objects kept per CPU, per cache
+#define SLABBATCH  8   // objects moved to or from the slabs at once
+
+// Header at the start of each slab, followed by the stack of
+// free object indices, then the objects themselves.
+struct slab {
+  struct slab *next;   // on cache's partial or full list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  int inuse;           // objects allocated from this slab
+  int nfree;           // entries in freeidx[]
+  ushort *freeidx;     // stack of free object indices
+  char *objs;          // first object
+};
+
+// Free objects cached by one CPU. Each has its own lock so
+// that slab_shrink() can drain other CPUs' arrays.
+struct cpucache {
+  struct spinlock lock;
+  int n;
+  void *obj[SLABCPU];
+  uint64 nalloc;       // allocations on this CPU
+};
+
+struct kmem_cache {
+  struct spinlock lock;  // protects the slab lists and counts
+  char *name;
+  uint size;             // object size, rounded up to 8 bytes
+  void (*ctor)(void*);
+  int order;             // each slab is 2^order pages
+  int perslab;           // objects per slab
+  struct slab partial;   // list of slabs with free objects
+  struct slab full;      // list of slabs with none
+  int nslabs;
+  int nactive;           // objects out of the slabs (incl. CPU arrays)
+  struct cpucache cpu[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  int n;
+  struct kmem_cache caches[NSLABCACHE];
+} slabs;
+
+static int slab_shrink(void);
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+  kshrinker(slab_shrink);
+}
+
+static void
+slab_push(struct slab *head, struct slab *s)
+{
+  s->next = head->next;
+  s->prev = head;
+  head->next->prev = s;
+  head->next = s;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Create a cache of objects of the given size. ctor, if not 0,
+// is called on every object when its slab is created.
+// Caches are never destroyed.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size, void (*ctor)(void*))
+{
+  struct kmem_cache *c;
+  int order, n;
+
+  size = (size + 7) & ~7;
+
+  // use the smallest block, up to 4 pages, that holds
+  // at least 8 objects.
+  for(order = 0; ; order++){
+    n = ((PGSIZE << order) - sizeof(struct slab) - 8) / (size + sizeof(ushort));
+    if(n >= 8 || order == 2)
+      break;
+  }
+  if(n < 1)
+    panic("kmem_cache_create: object too big");
+
+  acquire(&slabs.lock);
+  if(slabs.n >= NSLABCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabs.caches[slabs.n++];
+  release(&slabs.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->ctor = ctor;
+  c->order = order;
+  c->perslab = n;
+  c->partial.next = c->partial.prev = &c->partial;
+  c->full.next = c->full.prev = &c->full;
+  for(int i = 0; i < NCPU; i++)
+    initlock(&c->cpu[i].lock, name);
+  return c;
+}
+
+// Allocate and construct a new slab for c.
+// Called without c's locks held, since kalloc_order()
+// may call the shrinkers.
+static struct slab*
+slab_new(struct kmem_cache *c)
+{
+  struct slab *s;
+  uint64 hdr;
+
+  if((s = kalloc_order(c->order)) == 0)
+    return 0;
+  hdr = sizeof(struct slab) + c->perslab * sizeof(ushort);
+  s->cache = c;
+  s->inuse = 0;
+  s->nfree = c->perslab;
+  s->freeidx = (ushort*)(s + 1);
+  s->objs = (char*)s + ((hdr + 7) & ~7);
+  for(int i = 0; i < c->perslab; i++){
+    s->freeidx[i] = c->perslab - 1 - i;
+    if(c->ctor)
+      c->ctor(s->objs + i * c->size);
+  }
+  return s;
+}
+
+// Take up to n objects from c's slabs into objs[].
+// Caller must hold c->lock.
+static int
+slab_take(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *s;
+  int i = 0;
+
+  while(i < n && (s = c->partial.next) != &c->partial){
+    while(i < n && s->nfree > 0){
+      objs[i++] = s->objs + s->freeidx[--s->nfree] * c->size;
+      s->inuse++;
+      c->nactive++;
+    }
+    if(s->nfree == 0){
+      slab_unlink(s);
+      slab_push(&c->full, s);
+    }
+  }
+  return i;
+}
+
+// Return obj to its slab. Returns the slab if it is now
+// entirely free, in which case it is off c's lists and the
+// caller should free it once c->lock is released.
+// Caller must hold c->lock.
+static struct slab*
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)((uint64)obj & ~((uint64)(PGSIZE << c->order) - 1));
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->nfree == 0){
+    // was full.
+    slab_unlink(s);
+    slab_push(&c->partial, s);
+  }
+  s->freeidx[s->nfree++] = ((char*)obj - s->objs) / c->size;
+  s->inuse--;
+  c->nactive--;
+  if(s->inuse == 0){
+    slab_unlink(s);
+    c->nslabs--;
+    return s;
+  }
+  return 0;
+}
+
+// Give n objects back to their slabs, and free any slab
+// that is left empty. Returns the number of slabs freed.
+static int
+slab_putn(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *empty = 0, *s;
+  int freed = 0;
+
+  acquire(&c->lock);
+  for(int i = 0; i < n; i++){
+    if((s = slab_put(c, objs[i])) != 0){
+      s->next = empty;
+      empty = s;
+    }
+  }
+  release(&c->lock);
+
+  while(empty){
+    s = empty;
+    empty = s->next;
+    kfree_order(s, c->order);
+    freed++;
+  }
+  return freed;
+}
+
+// Allocate an object from cache c.
+// Returns 0 if memory cannot be allocated.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct cpucache *cc;
+  struct slab *s;
+  void *batch[SLABBATCH];
+  void *obj = 0;
+  int n, i;
+
+  push_off();
+  cc = &c->cpu[cpuid()];
+  acquire(&cc->lock);
+  if(cc->n > 0){
+    obj = cc->obj[--cc->n];
+    cc->nalloc++;
+  }
+  release(&cc->lock);
+  pop_off();
+  if(obj)
+    return obj;
+
+  // this CPU's array is empty: take a batch from the slabs,
+  // making a new slab if there are no free objects.
+  acquire(&c->lock);
+  n = slab_take(c, batch, SLABBATCH);
+  release(&c->lock);
+  if(n == 0){
+    if((s = slab_new(c)) == 0)
+      return 0;
+    acquire(&c->lock);
+    slab_push(&c->partial, s);
+    c->nslabs++;
+    n = slab_take(c, batch, SLABBATCH);
+    release(&c->lock);
+  }
+
+  // keep the rest of the batch in this CPU's array.
+  push_off();
+  cc = &c->cpu[cpuid()];
+  acquire(&cc->lock);
+  cc->nalloc++;
+  for(i = 1; i < n && cc->n < SLABCPU; i++)
+    cc->obj[cc->n++] = batch[i];
+  release(&cc->lock);
+  pop_off();
+  if(i < n)
+    slab_putn(c, batch + i, n - i);
+
+  return batch[0];
+}
+
+// Return obj, which must be in its constructed
+// state, to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct cpucache *cc;
+  void *batch[SLABBATCH];
+  int n = 0;
+
+  push_off();
+  cc = &c->cpu[cpuid()];
+  acquire(&cc->lock);
+  if(cc->n == SLABCPU){
+    // this CPU's array is full: flush the oldest batch.
+    n = SLABBATCH;
+    memmove(batch, cc->obj, sizeof(batch));
+    memmove(cc->obj, cc->obj + n, (SLABCPU - n) * sizeof(void*));
+    cc->n -= n;
+  }
+  cc->obj[cc->n++] = obj;
+  release(&cc->lock);
+  pop_off();
+
+  if(n)
+    slab_putn(c, batch, n);
+}
+
+// Flush every CPU's array back to the slabs, freeing the
+// slabs that become empty. Called by kalloc when memory
+// runs out. Returns the number of slabs freed.
+static int
+slab_shrink(void)
+{
+  struct kmem_cache *c;
+  void *batch[SLABCPU];
+  int n, freed = 0;
+
+  for(c = slabs.caches; c < &slabs.caches[slabs.n]; c++){
+    for(int i = 0; i < NCPU; i++){
+      acquire(&c->cpu[i].lock);
+      n = c->cpu[i].n;
+      memmove(batch, c->cpu[i].obj, n * sizeof(void*));
+      c->cpu[i].n = 0;
+      release(&c->cpu[i].lock);
+      if(n > 0)
+        freed += slab_putn(c, batch, n);
+    }
+  }
+  return freed;
+}
+
+// Fill in the per-cache part of a struct memstat.
+void
+slabstat(struct memstat *st)
+{
+  struct kmem_cache *c;
+  struct slabinfo *si;
+
+  st->nslab = slabs.n;
+  for(int i = 0; i < slabs.n; i++){
+    c = &slabs.caches[i];
+    si = &st->slab[i];
+    safestrcpy(si->name, c->name, sizeof(si->name));
+    si->nalloc = 0;
+    for(int j = 0; j < NCPU; j++){
+      acquire(&c->cpu[j].lock);
+      si->nalloc += c->cpu[j].nalloc;
+      release(&c->cpu[j].lock);
+    }
+    acquire(&c->lock);
+    si->objsize = c->size;
+    si->perslab = c->perslab;
+    si->slabsize = PGSIZE << c->order;
+    si->nslabs = c->nslabs;
+    si->nactive = c->nactive;
+    release(&c->lock);
+  }
+}
@@ -40,6 +40,15 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // look for the vector unit, which string.c turns on
+  // while it uses it, and turn on cbo.zero.
+  if(r_misa() & MISA_V)
+    hasrvv = 1;
+  // menvcfg.CBZE is read-only 0 without Zicboz.
+  w_menvcfg(r_menvcfg() | MENVCFG_CBZE);
+  if(r_menvcfg() & MENVCFG_CBZE)
+    hascboz = 1;
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
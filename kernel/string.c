@@ -1,13 +1,88 @@
 #include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+// memset(), memmove() and memcmp() work a word at a time
+// where they can, or with the vector unit if the hart has one.
+// memset() zeroes whole cache blocks with cbo.zero (Zicboz).
+// start() looks for the extensions; like the rest of xv6, this
+// assumes that every hart has the same ones.
+
+int hasrvv;              // vector extension
+int hascboz;             // Zicboz
+static uint cbozsize;    // bytes cbo.zero zeroes, or 0
+
+// shorter calls are not worth the vector unit.
+#define VMIN 64
+
+// Find out how much cbo.zero zeroes. Called once, after kinit().
+void
+stringinit(void)
+{
+  char *p;
+  uint n;
+
+  if(!hascboz || (p = kalloc()) == 0)
+    return;
+  memset(p, 0xff, PGSIZE);
+  cbo_zero(p);
+  for(n = 0; n < PGSIZE && p[n] == 0; n++)
+    ;
+  if(n >= 8 && (n & (n - 1)) == 0)
+    cbozsize = n;
+  kfree(p);
+}
+
+// The kernel does not save the vector registers on traps or
+// context switches, so vstring.S runs with interrupts off, and
+// the vector unit is on (sstatus.VS) only meanwhile: user code,
+// which would find its registers clobbered, cannot use it.
+static int
+vbegin(void)
+{
+  int on = intr_get();
+
+  intr_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INITIAL);
+  return on;
+}
+
+static void
+vend(int on)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  if(on)
+    intr_on();
+}
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  char *d = (char *) dst;
+  uint64 w;
+  int on;
+
+  if(c == 0 && cbozsize && n >= 2*cbozsize){
+    for(; (uint64)d % cbozsize; n--)
+      *d++ = 0;
+    for(; n >= cbozsize; n -= cbozsize, d += cbozsize)
+      cbo_zero(d);
   }
+  if(hasrvv && n >= VMIN){
+    on = vbegin();
+    vmemset(d, c, n);
+    vend(on);
+    return dst;
+  }
+
+  w = (uchar)c * 0x0101010101010101ULL;
+  for(; n > 0 && ((uint64)d & 7); n--)
+    *d++ = c;
+  for(; n >= 8; n -= 8, d += 8)
+    *(uint64*)d = w;
+  for(; n > 0; n--)
+    *d++ = c;
   return dst;
 }
 
@@ -15,9 +90,25 @@ int
 memcmp(const void *v1, const void *v2, uint n)
 {
   const uchar *s1, *s2;
+  int on, r;
 
   s1 = v1;
   s2 = v2;
+  if(hasrvv && n >= VMIN){
+    on = vbegin();
+    r = vmemcmp(s1, s2, n);
+    vend(on);
+    return r;
+  }
+
+  // skip equal words, then find the byte that differs.
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    for(; n > 0 && ((uint64)s1 & 7) && *s1 == *s2; n--)
+      s1++, s2++;
+    if(((uint64)s1 & 7) == 0)
+      for(; n >= 8 && *(uint64*)s1 == *(uint64*)s2; n -= 8)
+        s1 += 8, s2 += 8;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +123,44 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  int on, words;
 
   if(n == 0)
     return dst;
-  
+  if(hasrvv && n >= VMIN){
+    on = vbegin();
+    vmemmove(dst, src, n);
+    vend(on);
+    return dst;
+  }
+
   s = src;
   d = dst;
+  // words only line up if s and d do.
+  words = (((uint64)s ^ (uint64)d) & 7) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(words){
+      for(; n > 0 && ((uint64)d & 7); n--)
+        *--d = *--s;
+      for(; n >= 8; n -= 8){
+        d -= 8, s -= 8;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(words){
+      for(; n > 0 && ((uint64)d & 7); n--)
+        *d++ = *s++;
+      for(; n >= 8; n -= 8, d += 8, s += 8)
+        *(uint64*)d = *(const uint64*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
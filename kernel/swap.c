@@ -0,0 +1,163 @@
+//
+// Swap space on the second virtio disk (see virtio_disk.c).
+//
+// The disk is divided into page-sized slots. A page that
+// zswap.c's reclaim writes there is replaced in its page table
+// by a swap entry: not valid, marked PTE_SWAP|PTE_SWAPDISK,
+// with the slot number in place of the physical page number
+// and the page's permissions kept. swap_in() reads it back
+// when vmfault() finds the entry.
+//
+// After fork(), parent and child share a slot until each has
+// read it back, so each slot has a count of the swap entries
+// that refer to it; it is free when the count is 0. Slots are
+// handed out in order, so that pages written out together lie
+// together on the disk.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define SWAPDISK 1                    // virtio disk number
+#define SECTORS  (PGSIZE/512)         // disk sectors per slot
+
+#define SLOT(pte) ((uint)((pte) >> 10))
+#define SWAPENTRY(slot) (((uint64)(slot) << 10) | PTE_SWAP | PTE_SWAPDISK)
+
+static struct {
+  struct spinlock lock;
+  uchar *ref;       // swap entries that refer to each slot
+  uint nslot;
+  uint next;        // where to look for a free slot
+  uint64 nused;
+  uint64 nout;
+  uint64 nin;
+} swap;
+
+void
+swapinit(void)
+{
+  uint64 n;
+  int order;
+
+  initlock(&swap.lock, "swap");
+  if((n = virtio_disk_size(SWAPDISK) / SECTORS) == 0)
+    return;
+  if(n > (PGSIZE << MAXORDER))
+    n = PGSIZE << MAXORDER;
+  for(order = 0; (PGSIZE << order) < n; order++)
+    ;
+  if((swap.ref = kalloc_order(order)) == 0)
+    return;
+  memset(swap.ref, 0, PGSIZE << order);
+  swap.nslot = n;
+}
+
+// Is there a swap disk?
+int
+swapon(void)
+{
+  return swap.nslot > 0;
+}
+
+// Start writing the page at pa to a free slot, setting *busy
+// until it is done (see swap_wait()). Sets *entry to the swap
+// entry, less permissions, that refers to it.
+// Returns 0, or -1 if there is no free slot.
+int
+swap_out(void *pa, pte_t *entry, int *busy)
+{
+  uint i, slot;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    slot = (swap.next + i) % swap.nslot;
+    if(swap.ref[slot] == 0)
+      break;
+  }
+  if(i == swap.nslot){
+    release(&swap.lock);
+    return -1;
+  }
+  swap.ref[slot] = 1;
+  swap.next = slot + 1;
+  swap.nused++;
+  swap.nout++;
+  release(&swap.lock);
+
+  virtio_disk_start(SWAPDISK, (uint64)slot * SECTORS, pa, PGSIZE, 1, busy);
+  *entry = SWAPENTRY(slot);
+  return 0;
+}
+
+// Wait for a write started by swap_out().
+void
+swap_wait(int *busy)
+{
+  virtio_disk_wait(SWAPDISK, busy);
+}
+
+// Drop a reference to the slot of swap entry pte.
+void
+swap_drop(pte_t pte)
+{
+  acquire(&swap.lock);
+  if(SLOT(pte) >= swap.nslot || swap.ref[SLOT(pte)] == 0)
+    panic("swap_drop");
+  if(--swap.ref[SLOT(pte)] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Add a reference to the slot of swap entry pte,
+// which fork() has copied.
+void
+swap_dup(pte_t pte)
+{
+  acquire(&swap.lock);
+  if(swap.ref[SLOT(pte)] == 255)
+    panic("swap_dup");
+  swap.ref[SLOT(pte)]++;
+  release(&swap.lock);
+}
+
+// Replace the swap entry *pte with a mapping of a new page
+// read from its slot. Returns the page's physical address,
+// or 0 if out of memory. Caller must hold the address
+// space's lock.
+uint64
+swap_in(pte_t *pte)
+{
+  pte_t old = *pte;
+  char *mem;
+  int busy;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  virtio_disk_start(SWAPDISK, (uint64)SLOT(old) * SECTORS, mem, PGSIZE, 0, &busy);
+  virtio_disk_wait(SWAPDISK, &busy);
+  *pte = PA2PTE(mem) | (old & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_V | PTE_A | PTE_D;
+  swap_drop(old);
+
+  acquire(&swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+  return (uint64)mem;
+}
+
+// Fill in the swap part of a struct memstat.
+void
+swapstat(struct memstat *st)
+{
+  acquire(&swap.lock);
+  st->nswapslots = swap.nslot;
+  st->nswap = swap.nused;
+  st->swout = swap.nout;
+  st->swin = swap.nin;
+  release(&swap.lock);
+}
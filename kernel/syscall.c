@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
@@ -12,9 +13,9 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  if(addr >= p->vm->sz || addr+sizeof(uint64) > p->vm->sz) // both tests needed, in case of overflow
     return -1;
-  if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
+  if(copyin(p->vm->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
   return 0;
 }
@@ -25,7 +26,7 @@ int
 fetchstr(uint64 addr, char *buf, int max)
 {
   struct proc *p = myproc();
-  if(copyinstr(p->pagetable, buf, addr, max) < 0)
+  if(copyinstr(p->vm->pagetable, buf, addr, max) < 0)
     return -1;
   return strlen(buf);
 }
@@ -105,6 +106,20 @@ extern uint64 sys_close(void);
 extern uint64 sys_settickets(void);
 extern uint64 sys_getpinfo(void);
 extern uint64 sys_getsyscallcount(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_buddytest(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_shmcreate(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_asidctl(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_futexwait(void);
+extern uint64 sys_futexwake(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_zswapctl(void);
+extern uint64 sys_diskpoll(void);
 
 // System call names for tracing
 // Each system call number maps to a name string
@@ -133,6 +148,20 @@ static char *syscall_names[] = {
 [SYS_settickets] "settickets",
 [SYS_getpinfo]   "getpinfo",
 [SYS_getsyscallcount] "getsyscallcount",
+[SYS_memstat]    "memstat",
+[SYS_buddytest]  "buddytest",
+[SYS_mmap]       "mmap",
+[SYS_munmap]     "munmap",
+[SYS_shmcreate]  "shmcreate",
+[SYS_shmat]      "shmat",
+[SYS_shmdt]      "shmdt",
+[SYS_asidctl]    "asidctl",
+[SYS_clone]      "clone",
+[SYS_futexwait]  "futexwait",
+[SYS_futexwake]  "futexwake",
+[SYS_spawn]      "spawn",
+[SYS_zswapctl]   "zswapctl",
+[SYS_diskpoll]   "diskpoll",
 };
 
 // An array mapping syscall numbers from syscall.h
@@ -162,6 +191,20 @@ static uint64 (*syscalls[])(void) = {
 [SYS_settickets] sys_settickets,
 [SYS_getpinfo]   sys_getpinfo,
 [SYS_getsyscallcount] sys_getsyscallcount,
+[SYS_memstat]    sys_memstat,
+[SYS_buddytest]  sys_buddytest,
+[SYS_mmap]       sys_mmap,
+[SYS_munmap]     sys_munmap,
+[SYS_shmcreate]  sys_shmcreate,
+[SYS_shmat]      sys_shmat,
+[SYS_shmdt]      sys_shmdt,
+[SYS_asidctl]    sys_asidctl,
+[SYS_clone]      sys_clone,
+[SYS_futexwait]  sys_futexwait,
+[SYS_futexwake]  sys_futexwake,
+[SYS_spawn]      sys_spawn,
+[SYS_zswapctl]   sys_zswapctl,
+[SYS_diskpoll]   sys_diskpoll,
 };
 
 void
@@ -178,7 +221,7 @@ syscall(void)
     
     // PART I: COUNT THIS SYSCALL
     // Increment the counter for this syscall
-    if(num < 25) {  // We have 24 syscalls now
+    if(num < NSYSCALL) {
       p->syscall_count[num]++;
     }
     
@@ -24,3 +24,18 @@
 #define SYS_settickets 22  // Processin bilet sayısını ayarla
 #define SYS_getpinfo   23  // Process bilgilerini al 
 #define SYS_getsyscallcount 24  // Get syscall count for current process
+
+#define SYS_memstat    25  // physical memory allocator statistics
+#define SYS_buddytest  26  // drive the buddy allocator from user space
+#define SYS_mmap       27  // map a file or anonymous memory
+#define SYS_munmap     28  // unmap part of an mmap region
+#define SYS_shmcreate  29  // make a shared memory segment
+#define SYS_shmat      30  // attach a shared memory segment
+#define SYS_shmdt      31  // detach a shared memory segment
+#define SYS_asidctl    32  // turn address-space identifiers on or off
+#define SYS_clone      33  // create a thread sharing the address space
+#define SYS_futexwait  34  // sleep while a user word holds a value
+#define SYS_futexwake  35  // wake threads sleeping on a user word
+#define SYS_spawn      36  // create a child running a program
+#define SYS_zswapctl   37  // choose where reclaim puts cold pages
+#define SYS_diskpoll   38  // choose which disk waits poll
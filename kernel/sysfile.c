@@ -10,9 +10,9 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
 
@@ -25,7 +25,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->files->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -40,14 +40,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct filetable *ft = myproc()->files;
 
+  acquire(&ft->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(ft->ofile[fd] == 0){
+      ft->ofile[fd] = f;
+      release(&ft->lock);
       return fd;
     }
   }
+  release(&ft->lock);
   return -1;
 }
 
@@ -100,9 +103,18 @@ sys_close(void)
   int fd;
   struct file *f;
 
+  struct filetable *ft = myproc()->files;
+
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // another thread may have closed it meanwhile.
+  acquire(&ft->lock);
+  if(ft->ofile[fd] != f){
+    release(&ft->lock);
+    return -1;
+  }
+  ft->ofile[fd] = 0;
+  release(&ft->lock);
   fileclose(f);
   return 0;
 }
@@ -355,6 +367,7 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    memset(&f->ra, 0, sizeof(f->ra));
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -410,8 +423,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct filetable *ft = myproc()->files;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,26 +438,33 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&ft->lock);
+  old = ft->cwd;
+  ft->cwd = ip;
+  release(&ft->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Fetch the user's argument vector at uargv into argv[MAXARG],
+// a page per string. Returns 0, or -1 with nothing allocated.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -460,18 +480,57 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = kexec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = kexec(myproc(), path, argv);
 
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds): start a child running path, without
+// copying the caller's memory. fds points to three descriptors
+// that become the child's 0, 1 and 2 (-1 leaves one closed), or
+// is 0 to pass on the caller's own 0, 1 and 2. The child gets
+// no other descriptors. Returns the child's pid, or -1.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fds[3] = { 0, 1, 2 };
+  uint64 uargv, ufds;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(ufds != 0 && copyin(myproc()->vm->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = kspawn(path, argv, fds);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -487,19 +546,154 @@ sys_pipe(void)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+    if(fd0 >= 0){
+      acquire(&p->files->lock);
+      p->files->ofile[fd0] = 0;
+      release(&p->files->lock);
+    }
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
-  if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
-     copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+  if(copyout(p->vm->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
+     copyout(p->vm->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
+    acquire(&p->files->lock);
+    p->files->ofile[fd0] = 0;
+    p->files->ofile[fd1] = 0;
+    release(&p->files->lock);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+// mmap(addr, len, prot, flags, fd, off): map len bytes of the
+// file open on fd from offset off, or of zeroed memory if flags
+// has MAP_ANONYMOUS. addr is only a hint and is ignored.
+// Returns the address of the mapping, or -1.
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, off, perm;
+  struct file *f = 0;
+  struct inode *ip = 0;
+  uint filesz = 0;
+  uint64 addr;
+  struct proc *p = myproc();
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(len == 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE)
+      return -1;
+    if((prot & PROT_READ) && !f->readable)
+      return -1;
+    if((prot & PROT_WRITE) && (flags & MAP_SHARED) && !f->writable)
+      return -1;
+    ilock(f->ip);
+    if(f->ip->size > off)
+      filesz = f->ip->size - off;
+    iunlock(f->ip);
+    if(filesz > len)
+      filesz = len;
+    ip = idup(f->ip);
+  }
+
+  perm = PTE_U;
+  if(prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  acquiresleep(&p->vm->lock);
+  addr = vma_map(p, len, perm, flags & (MAP_SHARED|MAP_PRIVATE), ip, off, filesz);
+  releasesleep(&p->vm->lock);
+  if(addr == -1 && ip){
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+  return addr;
+}
+
+// munmap(addr, len): unmap the pages from addr to addr+len
+// in mmap regions, writing back those of MAP_SHARED files.
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+  struct proc *p = myproc();
+  int r;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  acquiresleep(&p->vm->lock);
+  r = vma_unmap(p, addr, len);
+  releasesleep(&p->vm->lock);
+  return r;
+}
+
+// shmcreate(size): make a shared memory segment of
+// size bytes, and return a file descriptor for it.
+uint64
+sys_shmcreate(void)
+{
+  uint64 size;
+  struct file *f;
+  int fd;
+
+  argaddr(0, &size);
+  if(shmalloc(size, &f) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// shmat(fd): map the segment open on fd, and
+// return its address.
+uint64
+sys_shmat(void)
+{
+  struct file *f;
+  struct proc *p = myproc();
+  uint64 addr;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_SHM)
+    return -1;
+  acquiresleep(&p->vm->lock);
+  addr = shmattach(p, f->shm);
+  releasesleep(&p->vm->lock);
+  return addr;
+}
+
+// shmdt(addr): unmap the segment attached at addr.
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+  struct vma *v;
+  struct proc *p = myproc();
+  int r = -1;
+
+  argaddr(0, &addr);
+  acquiresleep(&p->vm->lock);
+  if((v = vma_find(p, addr)) != 0 && (v->flags & VMA_SHM) && v->start == addr)
+    r = vma_unmap(p, v->start, v->end - v->start);
+  releasesleep(&p->vm->lock);
+  return r;
+}
@@ -4,9 +4,11 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "pstat.h"  // LOTTERY SCHEDULER: Process istatistikleri için
 #include "vm.h"
+#include "memstat.h"
 
 uint64
 sys_exit(void)
@@ -43,25 +45,27 @@ sys_sbrk(void)
   uint64 addr;
   int t;
   int n;
+  struct vmspace *vm = myproc()->vm;
 
   argint(0, &n);
   argint(1, &t);
-  addr = myproc()->sz;
+  acquiresleep(&vm->lock);
+  addr = vm->sz;
 
   if(t == SBRK_EAGER || n < 0) {
     if(growproc(n) < 0) {
-      return -1;
+      addr = -1;
     }
   } else {
     // Lazily allocate memory for this process: increase its memory
     // size but don't allocate memory. If the processes uses the
     // memory, vmfault() will allocate it.
-    if(addr + n < addr)
-      return -1;
-    if(addr + n > TRAPFRAME)
-      return -1;
-    myproc()->sz += n;
+    if(addr + n < addr || addr + n > vma_limit(myproc()))
+      addr = -1;
+    else
+      vm->sz += n;
   }
+  releasesleep(&vm->lock);
   return addr;
 }
 
@@ -198,7 +202,7 @@ sys_getpinfo(void)
   //
   // Why copyout? Because kernel and user are in different memory spaces!
   // We can't use direct memcpy, must copy through page table
-  if(copyout(myproc()->pagetable, addr, (char *)&pstat, sizeof(pstat)) < 0)
+  if(copyout(myproc()->vm->pagetable, addr, (char *)&pstat, sizeof(pstat)) < 0)
     return -1;  // Copy error
   
   return 0;  // Success!
@@ -230,8 +234,8 @@ sys_getsyscallcount(void)
   argint(0, &syscall_num);
   
   // STEP 2: Validate syscall number
-  // Must be between 0 and 24 (we have 25 syscalls: 0-24)
-  if(syscall_num < 0 || syscall_num >= 25)
+  // Must be between 0 and NSYSCALL-1
+  if(syscall_num < 0 || syscall_num >= NSYSCALL)
     return -1;
   
   // STEP 3: Return the count for this syscall
@@ -239,3 +243,114 @@ sys_getsyscallcount(void)
   struct proc *p = myproc();
   return p->syscall_count[syscall_num];
 }
+
+// Copy the page and slab allocators' statistics
+// to the struct memstat at the user address in arg 0.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct memstat st;
+
+  argaddr(0, &addr);
+  kmemstat(&st);
+  slabstat(&st);
+  pcachestat(&st);
+  zswapstat(&st);
+  swapstat(&st);
+  bcachestat(&st);
+  virtio_disk_stat(&st);
+  ioschedstat(&st);
+  if(copyout(myproc()->vm->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Test hook for the buddy allocator: buddytest(op, arg),
+// with op one of BT_ALLOC, BT_FREE, BT_RESET.
+uint64
+sys_buddytest(void)
+{
+  int op, arg;
+
+  argint(0, &op);
+  argint(1, &arg);
+  return kalloctest(myproc()->pid, op, arg);
+}
+
+// asidctl(on): use address-space identifiers or not.
+// Returns the old setting, or -1 if the hardware has none.
+uint64
+sys_asidctl(void)
+{
+  int on;
+
+  argint(0, &on);
+  return asidctl(on);
+}
+
+// zswapctl(on): what to do with cold pages under memory
+// pressure, ZSWAP_COMPRESS and/or ZSWAP_DISK (memstat.h).
+// Returns the old setting.
+uint64
+sys_zswapctl(void)
+{
+  int on;
+
+  argint(0, &on);
+  return zswapctl(on);
+}
+
+// diskpoll(mode): which waits for the disk poll before
+// sleeping, DISKPOLL_OFF, DISKPOLL_SYNC or DISKPOLL_ALL
+// (memstat.h). Returns the old setting.
+uint64
+sys_diskpoll(void)
+{
+  int mode;
+
+  argint(0, &mode);
+  return virtio_disk_poll(mode);
+}
+
+// clone(fn, arg, stack): start a thread at fn(arg) on the
+// given stack, sharing memory and files with the caller.
+// Returns its pid.
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  if(stack % 16 != 0)
+    return -1;
+  return kclone(fn, arg, stack);
+}
+
+// futexwait(addr, val): sleep until futexwake(addr),
+// if the int at addr holds val.
+uint64
+sys_futexwait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futex_wait(addr, val);
+}
+
+// futexwake(addr, n): wake up to n threads sleeping
+// in futexwait(addr). Returns how many were woken.
+uint64
+sys_futexwake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futex_wake(addr, n);
+}
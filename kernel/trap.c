@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -10,6 +11,7 @@ struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[];
+extern char uaccess_end[], uaccess_fail[];  // uaccess.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -29,6 +31,17 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// the access that caused a page fault, for vmfault().
+static int
+faultaccess(uint64 scause)
+{
+  if(scause == 12)
+    return PTE_X;
+  if(scause == 13)
+    return PTE_R;
+  return PTE_W;
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from, and returns to, trampoline.S
@@ -47,6 +60,9 @@ usertrap(void)
   w_stvec((uint64)kernelvec);  //DOC: kernelvec
 
   struct proc *p = myproc();
+
+  // see asid_shootdown().
+  mycpu()->ntrap++;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -68,8 +84,8 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
-  } else if((r_scause() == 15 || r_scause() == 13) &&
-            vmfault(p->pagetable, r_stval(), (r_scause() == 13)? 1 : 0) != 0) {
+  } else if((r_scause() == 15 || r_scause() == 13 || r_scause() == 12) &&
+            vmfault(p->vm->pagetable, r_stval(), faultaccess(r_scause())) != 0) {
     // page fault on lazily-allocated page
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
@@ -92,7 +108,7 @@ usertrap(void)
   prepare_return();
 
   // the user page table to switch to, for trampoline.S
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = asid_satp(p);
 
   // return to trampoline.S; satp value in a0.
   return satp;
@@ -122,6 +138,9 @@ prepare_return(void)
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
 
+  // where uservec finds this thread's trapframe.
+  w_sscratch(p->tfva);
+
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
   
@@ -150,7 +169,14 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)uaccess_copy && sepc < (uint64)uaccess_end){
+    // a copy through the user window (see vm.c) touched a
+    // page that is not there: fill it in and try again, or
+    // have the copy fail.
+    if(uwinfault(r_stval(), faultaccess(scause)) == 0)
+      sepc = (uint64)uaccess_fail;
+  } else if((which_dev = devintr()) == 0){
     // interrupt or trap from an unknown source
     printf("scause=0x%lx sepc=0x%lx stval=0x%lx\n", scause, r_sepc(), r_stval());
     panic("kerneltrap");
@@ -160,7 +186,7 @@ kerneltrap()
   if(which_dev == 2 && myproc() != 0)
     yield();
 
-  // the yield() may have caused some traps to occur,
+  // the yield() or uwinfault() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
@@ -201,7 +227,9 @@ devintr()
     if(irq == UART0_IRQ){
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+      virtio_disk_intr(0);
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_disk_intr(1);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
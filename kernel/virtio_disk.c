@@ -2,7 +2,15 @@
 // driver for qemu's virtio disk device.
 // uses qemu's mmio interface to virtio.
 //
-// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
+// qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,num-queues=N,bus=virtio-mmio-bus.0
+//
+// with num-queues (VIRTIO_BLK_F_MQ), each hart starts requests
+// on a virtqueue of its own. the buffer cache's requests come
+// by way of the I/O scheduler, iosched.c.
+//
+// disk 0 holds the file system. disk 1, if there is one, is
+// swap space (see swap.c):
+// qemu ... -drive file=swap.img,if=none,format=raw,id=x1 -device virtio-blk-device,drive=x1,bus=virtio-mmio-bus.1
 //
 
 #include "types.h"
@@ -15,11 +23,21 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "memstat.h"
 
-// the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+#define NDISK 2
+#define NVQ NCPU    // most virtqueues a disk uses
+
+// the address of disk d's virtio mmio register r.
+#define R(d, r) ((volatile uint32 *)((d)->base + (r)))
+
+// one virtqueue. with VIRTIO_BLK_F_MQ a disk has one for
+// each hart, so that harts starting requests at the same
+// time do not contend for one lock and one ring.
+struct vq {
+  struct spinlock lock;
+  int qi;          // queue number, for QUEUE_SEL and QUEUE_NOTIFY
 
-static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -46,119 +64,198 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    int *busy;        // cleared when the operation is done
+    struct buf *bufs; // or these buffers' b->disk, by b->ionext
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
-  struct spinlock vdisk_lock;
-  
-} disk;
 
-void
-virtio_disk_init(void)
+  // with VIRTIO_RING_F_INDIRECT_DESC, a request takes one
+  // descriptor, which points to the request's chain in a
+  // table of its own, ind[] of the descriptor's index.
+  struct virtq_desc (*ind)[MAXSEG+2];
+
+  int inflight;    // requests the device has not finished
+};
+
+static struct disk {
+  uint64 base;     // mmio registers
+  uint64 size;     // capacity in 512-byte sectors, or 0 if absent
+
+  int nq;          // virtqueues in use, at most NVQ
+  struct vq vq[NVQ];
+
+  int indirect;    // negotiated VIRTIO_RING_F_INDIRECT_DESC?
+
+  // with VIRTIO_RING_F_EVENT_IDX, the driver tells the
+  // device when it wants an interrupt, and the device
+  // tells the driver when it wants to be notified.
+  int eventidx;
+
+  // counted atomically, since each queue has its own lock.
+  uint64 nintr;    // interrupts taken
+  uint64 nnotify;  // notifications sent
+  uint64 npoll;    // times a poll found requests done
+} disk[NDISK];
+
+// how waits for the disk go; see virtio_disk_poll().
+static int pollmode = DISKPOLL_OFF;
+
+// most timer ticks a wait polls for, about 200us.
+#define POLLTIME 2000
+
+static void disk_poll(struct disk *, int *);
+
+// set up virtqueue qi of disk d.
+static void
+vq_init(struct disk *d, struct vq *q, int qi)
+{
+  initlock(&q->lock, "virtio_disk");
+  q->qi = qi;
+
+  // initialize the queue.
+  *R(d, VIRTIO_MMIO_QUEUE_SEL) = qi;
+
+  // ensure the queue is not in use.
+  if(*R(d, VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio disk should not be ready");
+
+  // check maximum queue size.
+  uint32 max = *R(d, VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+    panic("virtio disk has no queue");
+  if(max < NUM)
+    panic("virtio disk max queue too short");
+
+  // allocate and zero queue memory.
+  q->desc = kalloc();
+  q->avail = kalloc();
+  q->used = kalloc();
+  if(!q->desc || !q->avail || !q->used)
+    panic("virtio disk kalloc");
+  memset(q->desc, 0, PGSIZE);
+  memset(q->avail, 0, PGSIZE);
+  memset(q->used, 0, PGSIZE);
+  if(d->indirect){
+    if((q->ind = kalloc_order(INDORDER)) == 0)
+      panic("virtio disk kalloc");
+    memset(q->ind, 0, PGSIZE << INDORDER);
+  }
+
+  // set queue size.
+  *R(d, VIRTIO_MMIO_QUEUE_NUM) = NUM;
+
+  // write physical addresses.
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)q->desc;
+  *R(d, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)q->desc >> 32;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)q->avail;
+  *R(d, VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)q->avail >> 32;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)q->used;
+  *R(d, VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)q->used >> 32;
+
+  // queue is ready.
+  *R(d, VIRTIO_MMIO_QUEUE_READY) = 0x1;
+
+  // all NUM descriptors start out unused.
+  for(int i = 0; i < NUM; i++)
+    q->free[i] = 1;
+}
+
+// set up the disk at base, if there is one there.
+// returns 0, or -1 if there is none.
+static int
+disk_init(struct disk *d, uint64 base)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+  d->base = base;
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 2 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
+  if(*R(d, VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+     *R(d, VIRTIO_MMIO_VERSION) != 2 ||
+     *R(d, VIRTIO_MMIO_DEVICE_ID) != 2 ||
+     *R(d, VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+    return -1;
   }
   
   // reset device
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set ACKNOWLEDGE status bit
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // set DRIVER status bit
   status |= VIRTIO_CONFIG_S_DRIVER;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // negotiate features
-  uint64 features = *R(VIRTIO_MMIO_DEVICE_FEATURES);
+  uint64 features = *R(d, VIRTIO_MMIO_DEVICE_FEATURES);
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
-  *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  *R(d, VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  d->indirect = (features >> VIRTIO_RING_F_INDIRECT_DESC) & 1;
+  d->eventidx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
   // re-read status to ensure FEATURES_OK is set.
-  status = *R(VIRTIO_MMIO_STATUS);
+  status = *R(d, VIRTIO_MMIO_STATUS);
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-
-  // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
-    panic("virtio disk should not be ready");
-
-  // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
+  // with VIRTIO_BLK_F_MQ, num_queues in the config says
+  // how many queues the device has; use one per hart.
+  d->nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ))
+    d->nq = *R(d, VIRTIO_MMIO_CONFIG + 32) >> 16;  // num_queues, at 34
+  if(d->nq > NVQ)
+    d->nq = NVQ;
+  if(d->nq < 1)
+    d->nq = 1;
+  for(int i = 0; i < d->nq; i++)
+    vq_init(d, &d->vq[i], i);
 
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
-    panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
-
-  // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-
-  // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
+  // tell device we're completely ready.
+  status |= VIRTIO_CONFIG_S_DRIVER_OK;
+  *R(d, VIRTIO_MMIO_STATUS) = status;
 
-  // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+  d->size = *R(d, VIRTIO_MMIO_CONFIG) | (uint64)*R(d, VIRTIO_MMIO_CONFIG + 4) << 32;
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ
+  // and VIRTIO1_IRQ.
+  return 0;
+}
 
-  // tell device we're completely ready.
-  status |= VIRTIO_CONFIG_S_DRIVER_OK;
-  *R(VIRTIO_MMIO_STATUS) = status;
+void
+virtio_disk_init(void)
+{
+  if(disk_init(&disk[0], VIRTIO0) < 0)
+    panic("could not find virtio disk");
+  disk_init(&disk[1], VIRTIO1);
+}
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+// capacity of disk dev in 512-byte sectors, or 0 if
+// there is no such disk.
+uint64
+virtio_disk_size(int dev)
+{
+  return dev < NDISK ? disk[dev].size : 0;
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *q)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
@@ -167,28 +264,28 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct vq *q, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
+  wakeup(&q->free[0]);
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct vq *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -196,46 +293,80 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(struct vq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// has idx passed event, in going from old to new? from the
+// spec's vring_need_event().
+static int
+need_event(uint16 event, uint16 new, uint16 old)
+{
+  return (uint16)(new - event - 1) < (uint16)(new - old);
+}
+
+// start an operation on queue q of disk d, starting at sector, which
+// moves len bytes between data and the disk if bufs is 0,
+// and otherwise BSIZE bytes to or from each buffer on the
+// b->ionext chain at bufs, in turn. *busy is set now, and
+// cleared (with a wakeup) when it is done; the buffers go
+// back to iosched.c. if there are not enough descriptors,
+// waits for them, or for bufs returns -1 instead, since
+// iosched.c may call from an interrupt.
+// caller must hold q->lock.
+static int
+disk_start(struct disk *d, struct vq *q, uint64 sector, void *data, uint len, int *busy,
+           struct buf *bufs, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  struct buf *b;
+  int nseg = 1, i;
 
-  acquire(&disk.vdisk_lock);
+  if(bufs)
+    for(nseg = 0, b = bufs; b; b = b->ionext)
+      nseg++;
+  if(nseg > MAXSEG)
+    panic("disk_start");
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // data, one for a 1-byte status result. the data may be spread
+  // over a chain of descriptors instead of one.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors: with indirect descriptors, just
+  // the one in the ring, whose table holds the chain.
+  int idx[MAXSEG+2], head;
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(q, idx, d->indirect ? 1 : nseg + 2) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    if(bufs)
+      return -1;
+    sleep(&q->free[0], &q->lock);
   }
+  head = idx[0];
 
-  // format the three descriptors.
+  struct virtq_desc *desc = q->desc;
+  if(d->indirect){
+    desc = q->ind[head];
+    for(i = 0; i < nseg + 2; i++)
+      idx[i] = i;
+  }
+
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[head];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,57 +375,251 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  desc[idx[0]].addr = (uint64) buf0;
+  desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  desc[idx[0]].next = idx[1];
+
+  b = bufs;
+  for(i = 1; i <= nseg; i++){
+    if(b){
+      desc[idx[i]].addr = (uint64) b->data;
+      desc[idx[i]].len = BSIZE;
+      b = b->ionext;
+    } else {
+      desc[idx[i]].addr = (uint64) data;
+      desc[idx[i]].len = len;
+    }
+    if(write)
+      desc[idx[i]].flags = 0; // device reads data
+    else
+      desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes data
+    desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    desc[idx[i]].next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->info[head].status = 0xff; // device writes 0 on success
+  desc[idx[i]].addr = (uint64) &q->info[head].status;
+  desc[idx[i]].len = 1;
+  desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes the status
+  desc[idx[i]].next = 0;
+
+  if(d->indirect){
+    q->desc[head].addr = (uint64) desc;
+    q->desc[head].len = (nseg + 2) * sizeof(struct virtq_desc);
+    q->desc[head].flags = VRING_DESC_F_INDIRECT;
+    q->desc[head].next = 0;
+  }
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the request for virtio_disk_intr().
+  if(bufs == 0)
+    *busy = 1;
+  q->info[head].busy = busy;
+  q->info[head].bufs = bufs;
+  q->inflight++;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  q->avail->ring[q->avail->idx % NUM] = head;
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  uint16 old = q->avail->idx;
+  q->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  // with EVENT_IDX, only if the device asked to hear of this
+  // entry; otherwise it is still working through the ring.
+  if(!d->eventidx || need_event(q->used->avail_event, q->avail->idx, old)){
+    *R(d, VIRTIO_MMIO_QUEUE_NOTIFY) = q->qi; // value is queue number
+    __atomic_fetch_add(&d->nnotify, 1, __ATOMIC_RELAXED);
+  }
+  return 0;
+}
+
+// start reading or writing the buffers on the b->ionext
+// chain at b, which hold at most MAXSEG consecutive blocks,
+// on the file system's disk, on this hart's queue. for
+// iosched.c, which hears from iosched_done() when it is
+// finished. returns 0, or -1 if the queue is full.
+int
+virtio_disk_rw_trystart(struct buf *b, int write)
+{
+  struct disk *d = &disk[0];
+  struct vq *q;
+  int r;
+
+  push_off();
+  q = &d->vq[cpuid() % d->nq];
+  pop_off();
+
+  acquire(&q->lock);
+  r = disk_start(d, q, (uint64)b->blockno * (BSIZE / 512), 0, 0, 0, b, write);
+  release(&q->lock);
+  return r;
+}
+
+// before iosched_wait() sleeps until *busy clears: if the
+// wait should poll (sync says someone is waiting on it, as
+// for a log commit, which polls under DISKPOLL_SYNC as well
+// as DISKPOLL_ALL), spin for a while first.
+void
+virtio_disk_rw_poll(int *busy, int sync)
+{
+  if(pollmode == DISKPOLL_ALL || (pollmode == DISKPOLL_SYNC && sync))
+    disk_poll(&disk[0], busy);
+}
+
+// start moving len bytes between data and disk dev,
+// from sector on, without waiting for it to finish;
+// see virtio_disk_wait(). data must stay put until then.
+// these always go on queue 0.
+// returns 0, or -1 if there is no such disk.
+int
+virtio_disk_start(int dev, uint64 sector, void *data, uint len, int write, int *busy)
+{
+  struct disk *d;
+
+  if(dev >= NDISK || disk[dev].size == 0)
+    return -1;
+  d = &disk[dev];
+  acquire(&d->vq[0].lock);
+  disk_start(d, &d->vq[0], sector, data, len, busy, 0, write);
+  release(&d->vq[0].lock);
+  return 0;
+}
+
+// wait for an operation started by virtio_disk_start().
+void
+virtio_disk_wait(int dev, int *busy)
+{
+  struct vq *q = &disk[dev].vq[0];
+
+  if(pollmode == DISKPOLL_ALL)
+    disk_poll(&disk[dev], busy);
+  acquire(&q->lock);
+  while(*busy)
+    sleep(busy, &q->lock);
+  release(&q->lock);
+}
+
+// choose when waits for the disk poll: DISKPOLL_OFF,
+// DISKPOLL_SYNC or DISKPOLL_ALL (memstat.h), to compare.
+// returns the old setting.
+int
+virtio_disk_poll(int mode)
+{
+  int old = pollmode;
+
+  if(mode >= DISKPOLL_OFF && mode <= DISKPOLL_ALL)
+    pollmode = mode;
+  return old;
+}
+
+// finish the requests the device has put on q's used
+// ring. the buffers of those that had them go on the list
+// *done, by b->ionext, for iosched_done() once q->lock is
+// released.
+// caller must hold q->lock.
+static void
+disk_complete(struct disk *d, struct vq *q, struct buf **done)
+{
+  // the device increments q->used->idx when it
+  // adds an entry to the used ring.
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  while(1){
+    while(q->used_idx != q->used->idx){
+      __sync_synchronize();
+      int id = q->used->ring[q->used_idx % NUM].id;
+
+      if(q->info[id].status != 0)
+        panic("virtio_disk_intr status");
+
+      int *busy = q->info[id].busy;
+      struct buf *b = q->info[id].bufs;
+      q->info[id].busy = 0;
+      q->info[id].bufs = 0;
+      free_chain(q, id);
+      if(busy){
+        *busy = 0;   // disk is done with the data
+        wakeup(busy);
+      }
+      if(b){
+        struct buf *last = b;
+        while(last->ionext)
+          last = last->ionext;
+        last->ionext = *done;
+        *done = b;
+      }
+
+      q->used_idx += 1;
+      q->inflight -= 1;
+    }
+    if(!d->eventidx)
+      break;
+
+    // ask for the next interrupt once half the requests
+    // still in flight are done (or the next one, if there
+    // are few), so that under load one interrupt finishes
+    // several. then look again, in case the device went
+    // past that before it saw the new used_event.
+    q->avail->used_event = q->used_idx + (q->inflight > 1 ? q->inflight/2 - 1 : 0);
+    __sync_synchronize();
+    if(q->used_idx == q->used->idx)
+      break;
   }
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// finish what the device has put on the used rings of d's
+// queues, this hart's own first, each under its own lock.
+// returns whether there was anything.
+static int
+disk_drain(struct disk *d)
+{
+  struct buf *done = 0;
+  int i, me, found = 0;
+
+  push_off();
+  me = cpuid() % d->nq;
+  pop_off();
+
+  for(i = 0; i < d->nq; i++){
+    struct vq *q = &d->vq[(me + i) % d->nq];
+    if(q->used_idx == *(volatile uint16*)&q->used->idx)
+      continue;
+    acquire(&q->lock);
+    disk_complete(d, q, &done);
+    release(&q->lock);
+    found = 1;
+  }
+  if(done)
+    iosched_done(done);
+  return found;
+}
 
-  release(&disk.vdisk_lock);
+// spin for up to POLLTIME while *busy is set, finishing
+// requests as the device puts them on the used rings, since
+// for a short request that is sooner than the interrupt and
+// wakeup would be.
+static void
+disk_poll(struct disk *d, int *busy)
+{
+  uint64 t0 = r_time();
+
+  while(*(volatile int*)busy && r_time() - t0 < POLLTIME){
+    if(disk_drain(d))
+      __atomic_fetch_add(&d->npoll, 1, __ATOMIC_RELAXED);
+  }
 }
 
+// a virtio-mmio device has one interrupt line for all its
+// queues, so whichever hart the PLIC hands it to finishes
+// them all.
 void
-virtio_disk_intr()
+virtio_disk_intr(int dev)
 {
-  acquire(&disk.vdisk_lock);
+  struct disk *d = &disk[dev];
 
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
@@ -302,26 +627,23 @@ virtio_disk_intr()
   // the "used" ring, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
-  *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+  *R(d, VIRTIO_MMIO_INTERRUPT_ACK) = *R(d, VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+  __atomic_fetch_add(&d->nintr, 1, __ATOMIC_RELAXED);
+  disk_drain(d);
+}
 
-    disk.used_idx += 1;
-  }
+// copy disk 0's interrupt, notification and poll counts,
+// and its number of queues, into *st.
+void
+virtio_disk_stat(struct memstat *st)
+{
+  struct disk *d = &disk[0];
 
-  release(&disk.vdisk_lock);
+  st->dintr = __atomic_load_n(&d->nintr, __ATOMIC_RELAXED);
+  st->dnotify = __atomic_load_n(&d->nnotify, __ATOMIC_RELAXED);
+  st->dpoll = __atomic_load_n(&d->npoll, __ATOMIC_RELAXED);
+  st->dnq = d->nq;
 }
@@ -5,6 +5,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
 
@@ -17,6 +18,15 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// uvmunmap() flushes the TLB page by page for at most
+// this many pages, and the process's whole ASID for more.
+#define UNMAPFLUSH 16
+
+// copyin() and copyout() of at least this many bytes go
+// through the user window; shorter ones, and copyinstr(),
+// walk the page table.
+#define UWINMIN 256
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -31,6 +41,7 @@ kvmmake(void)
 
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
@@ -80,6 +91,15 @@ kvminithart()
 
   // flush stale entries from the TLB.
   sfence_vma();
+
+  // this hart's copy of the kernel page table, whose
+  // upper half uwinopen() fills in.
+  struct cpu *c = mycpu();
+  if(c->uwin == 0){
+    if((c->uwin = (pagetable_t) kalloc()) == 0)
+      panic("kvminithart");
+    memmove(c->uwin, kernel_pagetable, PGSIZE);
+  }
 }
 
 // Return the address of the PTE in page table pagetable
@@ -194,20 +214,54 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  struct proc *p = myproc();
+  int shared;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
+  // only the current process's page table can be
+  // in use; any other is new or being freed.
+  if(p && (p->vm == 0 || p->vm->pagetable != pagetable))
+    p = 0;
+  // other threads may still reach the pages through
+  // their harts' TLBs, so free them only afterwards.
+  shared = p && do_free && p->vm->ref > 1;
+
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0) // leaf page table entry allocated?
       continue;   
+    if(*pte & PTE_SWAP){     // compressed by zswap.c?
+      if(do_free)
+        zswap_drop(*pte);
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)  // has physical page been allocated?
       continue;
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+    if(shared){
+      *pte &= ~PTE_V;  // keep the address for below
+    } else {
+      if(do_free){
+        uint64 pa = PTE2PA(*pte);
+        kfree((void*)pa);
+      }
+      *pte = 0;
+    }
+    if(p && npages <= UNMAPFLUSH)
+      asid_flush(p->vm, a);
+  }
+  if(p && npages > UNMAPFLUSH)
+    asid_flush(p->vm, -1);
+
+  if(shared){
+    asid_shootdown(p->vm);
+    for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+      if((pte = walk(pagetable, a, 0)) == 0 || *pte == 0)
+        continue;
+      kfree((void*)PTE2PA(*pte));
+      *pte = 0;
     }
-    *pte = 0;
   }
 }
 
@@ -224,6 +278,7 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
+    zswap_balance();
     mem = kalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
@@ -290,27 +345,43 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory, except that read-only
+// pages are shared rather than copied,
+// as are pages compressed by zswap.c.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
+    zswap_balance();
     if((pte = walk(old, i, 0)) == 0)
       continue;   // page table entry hasn't been allocated
+    if(*pte & PTE_SWAP){
+      if((npte = walk(new, i, 1)) == 0)
+        goto err;
+      zswap_dup(*pte);
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       continue;   // physical page hasn't been allocated
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
+    if((flags & PTE_W) == 0){
+      // read-only, e.g. text: share the page.
+      kdup((void*)pa);
+      mem = (char*)pa;
+    } else {
+      if((mem = kalloc()) == 0)
+        goto err;
+      memmove(mem, (char*)pa, PGSIZE);
+    }
     if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
@@ -336,11 +407,130 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
-// Copy from kernel to user.
-// Copy len bytes from src to virtual address dstva in a given page table.
-// Return 0 on success, -1 on error.
+// copyout(), copyin() and copyinstr() reach the current
+// process's pages, through their physical addresses or the
+// user window, without holding its address space's lock;
+// vm->ncopy keeps zswap.c from taking the pages meanwhile.
+static struct vmspace*
+copybegin(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->vm == 0 || p->vm->pagetable != pagetable)
+    return 0;
+  __atomic_fetch_add(&p->vm->ncopy, 1, __ATOMIC_SEQ_CST);
+  return p->vm;
+}
+
+static void
+copyend(struct vmspace *vm)
+{
+  if(vm)
+    __atomic_fetch_sub(&vm->ncopy, 1, __ATOMIC_SEQ_CST);
+}
+
+// The user window. Each hart has a copy of the kernel page
+// table whose upper half is left for the current process's
+// user memory below UWINTOP: each of the user page table's
+// top-level entries is copied to the same place in the upper
+// half, so that the hardware finds the process's own page
+// tables there, and user address va can be reached at UWIN + va
+// with sstatus.SUM set. Large copies then go at the speed of
+// uaccess.S's loop rather than a page-table walk per page.
+//
+// The window's TLB entries carry an ASID of their own, kept
+// for it by asid.c. They may be stale for whichever process
+// opens the window next, or for this one's pages changed since,
+// so opening the window flushes that ASID, and only that: the
+// kernel's and the processes' entries stay. Without ASIDs to
+// spare, it flushes the whole TLB. A process that gives up the
+// CPU with the window open closes it in sched(), and opens it
+// again when it runs next.
+
+// Open this hart's user window onto the current process's
+// memory. Called with interrupts off.
+void
+uwinopen(void)
+{
+  pagetable_t uwin = mycpu()->uwin;
+
+  uint64 asid = asid_uwin();
+
+  memmove(&uwin[PX(2, UWIN)], myproc()->vm->pagetable,
+          PX(2, UWINTOP) * sizeof(pte_t));
+  w_satp(MAKE_SATP_ASID(uwin, asid));
+  if(asid)
+    sfence_vma_asid(asid);
+  else
+    sfence_vma();
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+}
+
+// Called with interrupts off.
+void
+uwinclose(void)
+{
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  w_satp(MAKE_SATP(kernel_pagetable));
+}
+
+static void
+uwinbegin(void)
+{
+  push_off();
+  myproc()->inuwin = 1;
+  uwinopen();
+  pop_off();
+}
+
+static void
+uwinend(void)
+{
+  push_off();
+  myproc()->inuwin = 0;
+  uwinclose();
+  pop_off();
+}
+
+// A page fault at va in uaccess.S, from kerneltrap(). access is
+// PTE_R or PTE_W. Returns 1 if the access should be retried, or
+// 0 if the copy should fail.
 int
-copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+uwinfault(uint64 va, int access)
+{
+  struct proc *p = myproc();
+  pagetable_t uwin = mycpu()->uwin;
+  uint64 uva = va - UWIN;
+
+  if(p == 0 || p->inuwin == 0 || va < UWIN || uva >= UWINTOP)
+    panic("uwinfault");
+
+  // a new top-level entry, made since the window was opened.
+  if(uwin[PX(2, va)] != p->vm->pagetable[PX(2, uva)]){
+    uwin[PX(2, va)] = p->vm->pagetable[PX(2, uva)];
+    if(asid_uwin())
+      sfence_vma_asid(asid_uwin());
+    else
+      sfence_vma();
+    return 1;
+  }
+
+  if(vmfault(p->vm->pagetable, uva, access) == 0)
+    return 0;
+  sfence_vma_page(va, asid_uwin());
+  return 1;
+}
+
+// Can the current process's pages in [va, va+len) be reached
+// through the user window?
+static int
+inuwin(struct vmspace *vm, uint64 va, uint64 len)
+{
+  return vm != 0 && va < UWINTOP && len <= UWINTOP - va;
+}
+
+static int
+copyout1(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
   pte_t *pte;
@@ -352,7 +542,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+      if((pa0 = vmfault(pagetable, va0, PTE_W)) == 0) {
         return -1;
       }
     }
@@ -374,11 +564,27 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   return 0;
 }
 
-// Copy from user to kernel.
-// Copy len bytes to dst from virtual address srcva in a given page table.
+// Copy from kernel to user.
+// Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int
-copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
+{
+  struct vmspace *vm = copybegin(pagetable);
+  int r;
+
+  if(len >= UWINMIN && inuwin(vm, dstva, len)){
+    uwinbegin();
+    r = uaccess_copy((void*)(UWIN + dstva), src, len);
+    uwinend();
+  } else
+    r = copyout1(pagetable, dstva, src, len);
+  copyend(vm);
+  return r;
+}
+
+static int
+copyin1(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
@@ -386,7 +592,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+      if((pa0 = vmfault(pagetable, va0, PTE_R)) == 0) {
         return -1;
       }
     }
@@ -402,12 +608,27 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
-// Copy a null-terminated string from user to kernel.
-// Copy bytes to dst from virtual address srcva in a given page table,
-// until a '\0', or max.
+// Copy from user to kernel.
+// Copy len bytes to dst from virtual address srcva in a given page table.
 // Return 0 on success, -1 on error.
 int
-copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
+copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  struct vmspace *vm = copybegin(pagetable);
+  int r;
+
+  if(len >= UWINMIN && inuwin(vm, srcva, len)){
+    uwinbegin();
+    r = uaccess_copy(dst, (void*)(UWIN + srcva), len);
+    uwinend();
+  } else
+    r = copyin1(pagetable, dst, srcva, len);
+  copyend(vm);
+  return r;
+}
+
+static int
+copyinstr1(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
@@ -415,8 +636,11 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0) {
+      if((pa0 = vmfault(pagetable, va0, PTE_R)) == 0) {
+        return -1;
+      }
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
@@ -445,33 +669,118 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
+// Copy a null-terminated string from user to kernel.
+// Copy bytes to dst from virtual address srcva in a given page table,
+// until a '\0', or max.
+// Return 0 on success, -1 on error.
+int
+copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
+{
+  struct vmspace *vm = copybegin(pagetable);
+  int r;
+
+  // strings are short, and their length is not known
+  // ahead, so they do not go through the user window.
+  r = copyinstr1(pagetable, dst, srcva, max);
+  copyend(vm);
+  return r;
+}
+
 // allocate and map user memory if process is referencing a page
-// that was lazily allocated in sys_sbrk().
-// returns 0 if va is invalid or already mapped, or if
-// out of physical memory, and physical address if successful.
+// that was lazily allocated in sys_sbrk(), or that belongs to
+// a demand-filled region such as an ELF segment or an mmap
+// region (see vma.c). access is PTE_R, PTE_W or PTE_X.
+// a page that zswap.c compressed is decompressed.
+// returns 0 if va is invalid, or if out of physical memory,
+// and physical address if successful. a page that is already
+// mapped with the access allowed was faulted in by another
+// thread, and is not an error.
 uint64
-vmfault(pagetable_t pagetable, uint64 va, int read)
+vmfault(pagetable_t pagetable, uint64 va, int access)
 {
-  uint64 mem;
+  uint64 mem = 0;
   struct proc *p = myproc();
+  struct vmspace *vm = p->vm;
+  struct vma *v;
+  pte_t *pte;
+  int perm = PTE_W|PTE_U|PTE_R;
 
-  if (va >= p->sz)
+  if(p->nofault)
     return 0;
+  zswap_balance();
+  acquiresleep(&vm->lock);
+  if((v = vma_find(p, va)) == 0 && va >= vm->sz)
+    goto out;
   va = PGROUNDDOWN(va);
-  if(ismapped(pagetable, va)) {
-    return 0;
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V)){
+    if((*pte & PTE_U) && (*pte & access))
+      mem = PTE2PA(*pte);
+    goto out;
+  }
+  if(pte && (*pte & PTE_SWAP)){
+    if((*pte & PTE_U) && (*pte & access) && (mem = zswap_in(pte)) != 0)
+      asid_mapped(vm, va);
+    goto out;
+  }
+  if(v){
+    if((v->perm & PTE_U) == 0 || (v->perm & access) == 0)
+      goto out;
+    // set A and D now rather than take a fault for them.
+    perm = v->perm | PTE_A | (access == PTE_W ? PTE_D : 0);
+  }
+  if(v){
+    mem = vma_page(v, va);
+  } else if((mem = (uint64) kalloc()) != 0){
+    memset((void *) mem, 0, PGSIZE);
   }
-  mem = (uint64) kalloc();
   if(mem == 0)
-    return 0;
-  memset((void *) mem, 0, PGSIZE);
-  if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
+    goto out;
+  if (mappages(vm->pagetable, va, PGSIZE, mem, perm) != 0) {
     kfree((void *)mem);
-    return 0;
+    mem = 0;
+    goto out;
   }
+  asid_mapped(vm, va);
+ out:
+  releasesleep(&vm->lock);
   return mem;
 }
 
+// vmfault() takes vm->lock, and to fill a page of a file may
+// then lock its inode, so it must not run with an inode locked:
+// another thread could hold vm->lock and be waiting for that
+// inode. So a read() or write() of a file faults in the user
+// pages it will copy, [va, va+n), before locking the inode, and
+// until uvmunpin() vm->ncopy keeps zswap.c from taking them and
+// a fault fails the copy instead of calling vmfault(), as when
+// another thread unmaps them meanwhile. access is PTE_R or PTE_W.
+void
+uvmpin(uint64 va, int n, int access)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 a;
+
+  __atomic_fetch_add(&p->vm->ncopy, 1, __ATOMIC_SEQ_CST);
+  for(a = PGROUNDDOWN(va); n > 0 && a < va + n && a < MAXVA; a += PGSIZE){
+    pte = walk(p->vm->pagetable, a, 0);
+    if(pte && (*pte & PTE_V) && (*pte & PTE_U) && (*pte & access))
+      continue;
+    if(vmfault(p->vm->pagetable, a, access) == 0)
+      break;    // the copy will fail here.
+  }
+  p->nofault = 1;
+}
+
+void
+uvmunpin(void)
+{
+  struct proc *p = myproc();
+
+  p->nofault = 0;
+  __atomic_fetch_sub(&p->vm->ncopy, 1, __ATOMIC_SEQ_CST);
+}
+
 int
 ismapped(pagetable_t pagetable, uint64 va)
 {
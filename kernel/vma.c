@@ -0,0 +1,410 @@
+//
+// Demand-filled regions of user memory.
+//
+// exec() does not read a program into memory; it records each
+// ELF segment as a struct vma naming the inode and offset its
+// pages come from, and vmfault() reads a page in the first time
+// it is touched. Pages past the file data (e.g. BSS) are zero.
+//
+// Each vma holds a reference to its inode, dropped when the
+// region goes away, so the pages can be filled later even if
+// the file has been unlinked.
+//
+// Read-only pages, such as a program's text, are shared
+// between processes through the page cache in pagecache.c,
+// and so are all pages of MAP_SHARED file regions.
+//
+// mmap() adds regions of the same kind, marked VMA_MMAP, above
+// p->vm->sz and below MMAPTOP. Their pages are outside [0, p->vm->sz),
+// so they are unmapped here rather than by uvmfree(). Dirty
+// pages of MAP_SHARED file regions are written back to the file
+// when they are unmapped; until then read() does not see what
+// was stored in them, though the regions see write() at once.
+// After fork(), parent and child share the pages of MAP_SHARED
+// regions and copy those of MAP_PRIVATE.
+// Attached shm segments (shm.c) are MAP_SHARED regions too.
+//
+// The trapframes of threads made by clone() sit in mmap regions
+// marked VMA_TF, which user code cannot touch, unmap or pass on
+// to a fork() child. They must lie in the top gigabyte, above
+// UWINTOP, where the kernel's copies cannot reach them.
+//
+// Regions belong to an address space (struct vmspace), shared
+// by a process's threads. Callers hold p->vm->lock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Return the region of p that contains va, or 0.
+struct vma*
+vma_find(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return the physical address of a page holding the contents
+// of va in region v, or 0 if out of memory or the file could not
+// be read. Read-only file pages and those of MAP_SHARED file
+// regions are shared through the page cache (see pagecache.c).
+uint64
+vma_page(struct vma *v, uint64 va)
+{
+  uint64 off = va - v->start;
+  char *mem;
+  uint n = 0;
+  int shared;
+
+  if(v->ip && (v->flags & MAP_SHARED)){
+    ilock(v->ip);
+    mem = pcache_shared(v->ip, v->off + off);
+    iunlock(v->ip);
+    return (uint64)mem;
+  }
+  if(v->ip && off < v->filesz){
+    n = v->filesz - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+  if(n == 0){
+    if((mem = kalloc()) != 0)
+      memset(mem, 0, PGSIZE);
+    return (uint64)mem;
+  }
+  shared = (v->perm & PTE_W) == 0;
+
+  ilock(v->ip);
+  if(shared && (mem = pcache_get(v->ip, v->off + off, n)) != 0)
+    goto out;
+  if((mem = kalloc()) == 0)
+    goto out;
+  memset(mem, 0, PGSIZE);
+  if(readi(v->ip, 0, (uint64)mem, v->off + off, n) != n){
+    kfree(mem);
+    mem = 0;
+    goto out;
+  }
+  if(shared)
+    pcache_put(v->ip, v->off + off, n, mem);
+ out:
+  iunlock(v->ip);
+  return (uint64)mem;
+}
+
+// Copy the pages p has mapped in its mmap regions to np,
+// sharing those of MAP_SHARED regions and read-only pages,
+// and give np copies of p's regions, for fork().
+// Returns 0 on success, -1 on failure, with nothing mapped
+// in np and no references taken.
+int
+vma_dup(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+  uint64 va, pa;
+  pte_t *pte, *npte;
+  char *mem;
+  int i;
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++){
+    if((v->flags & VMA_MMAP) == 0 || (v->flags & VMA_TF))
+      continue;
+    for(va = v->start; va < v->end; va += PGSIZE){
+      if((pte = walk(p->vm->pagetable, va, 0)) == 0)
+        continue;
+      if(*pte & PTE_SWAP){
+        // compressed by zswap.c; share it.
+        if((npte = walk(np->vm->pagetable, va, 1)) == 0)
+          goto err;
+        zswap_dup(*pte);
+        *npte = *pte;
+        continue;
+      }
+      if((*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      if((v->flags & MAP_SHARED) || (*pte & PTE_W) == 0){
+        kdup((void*)pa);
+        mem = (char*)pa;
+      } else {
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+      }
+      if(mappages(np->vm->pagetable, va, PGSIZE, (uint64)mem, PTE_FLAGS(*pte)) != 0){
+        kfree(mem);
+        goto err;
+      }
+    }
+  }
+
+  for(i = 0; i < NVMA; i++){
+    if(p->vm->vma[i].flags & VMA_TF)
+      continue;
+    np->vm->vma[i] = p->vm->vma[i];
+    if(np->vm->vma[i].ip)
+      np->vm->vma[i].ip = idup(np->vm->vma[i].ip);
+    if(np->vm->vma[i].shm)
+      shmdup(np->vm->vma[i].shm);
+  }
+  return 0;
+
+ err:
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if((v->flags & VMA_MMAP) && (v->flags & VMA_TF) == 0)
+      uvmunmap(np->vm->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+  return -1;
+}
+
+// Release every region in vma[NVMA].
+void
+vma_free(struct vma *vma)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++)
+    if(vma[i].shm)
+      shmput(vma[i].shm);
+  for(i = 0; i < NVMA; i++)
+    if(vma[i].ip)
+      break;
+  if(i < NVMA){
+    begin_op();
+    for(; i < NVMA; i++)
+      if(vma[i].ip)
+        iput(vma[i].ip);
+    end_op();
+  }
+  memset(vma, 0, NVMA * sizeof(struct vma));
+}
+
+// Cut p's regions back to end at sz, after p has shrunk,
+// so that pages above sz read as zero if p grows again.
+void
+vma_trim(struct proc *p, uint64 sz)
+{
+  struct vma *v;
+  struct inode *ip;
+
+  sz = PGROUNDUP(sz);
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++){
+    if(v->end <= sz || (v->flags & VMA_MMAP))
+      continue;
+    if(v->start < sz){
+      v->end = sz;
+      continue;
+    }
+    ip = v->ip;
+    memset(v, 0, sizeof(*v));
+    if(ip){
+      begin_op();
+      iput(ip);
+      end_op();
+    }
+  }
+}
+
+// Return the lowest address used by p's mmap regions,
+// which p->vm->sz must stay below.
+uint64
+vma_limit(struct proc *p)
+{
+  uint64 lim = MMAPTOP;
+
+  for(struct vma *v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if((v->flags & VMA_MMAP) && v->start < lim)
+      lim = v->start;
+  return lim;
+}
+
+// Add a region of len bytes to p, at the highest free address
+// below MMAPTOP and above p->vm->sz, taking over the caller's
+// reference to ip, if any. Returns its address, or -1.
+uint64
+vma_map(struct proc *p, uint64 len, int perm, int flags,
+        struct inode *ip, uint off, uint filesz)
+{
+  struct vma *v, *free = 0;
+  uint64 end = MMAPTOP;
+
+  len = PGROUNDUP(len);
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->start == v->end && free == 0)
+      free = v;
+  if(free == 0 || len == 0 || len > MMAPTOP)
+    return -1;
+
+  // first fit, from the top down.
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; ){
+    if(v->start < end && v->end > end - len){
+      end = v->start;
+      v = p->vm->vma;
+    } else
+      v++;
+  }
+  if(end < len || end - len < PGROUNDUP(p->vm->sz))
+    return -1;
+
+  free->start = end - len;
+  free->end = end;
+  free->perm = perm;
+  free->flags = flags | VMA_MMAP;
+  free->ip = ip;
+  free->off = off;
+  free->filesz = filesz;
+  return free->start;
+}
+
+// Write the page at va, mapped at pa, back to the file of
+// MAP_SHARED region v. Returns 0, or -1 if the write failed.
+static int
+vma_writeback(struct vma *v, uint64 va, uint64 pa)
+{
+  // at most this many bytes per transaction, as in filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint off = v->off + (va - v->start);
+  uint n, m;
+  int r = 0;
+
+  ilock(v->ip);
+  n = v->ip->size > off ? v->ip->size - off : 0;
+  iunlock(v->ip);
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  for(uint i = 0; i < n; i += m){
+    m = n - i;
+    if(m > max)
+      m = max;
+    begin_op();
+    ilock(v->ip);
+    if(writei(v->ip, 0, pa + i, off + i, m) != m)
+      r = -1;
+    iunlock(v->ip);
+    end_op();
+    if(r < 0)
+      break;
+  }
+  return r;
+}
+
+// Unmap the pages of region v from a to b, writing back
+// the dirty pages of a MAP_SHARED file region.
+// Returns 0, or -1 if a page could not be written back;
+// the pages are unmapped either way.
+static int
+vma_unmappages(struct proc *p, struct vma *v, uint64 a, uint64 b)
+{
+  pte_t *pte;
+  int r = 0;
+
+  if((v->flags & MAP_SHARED) && v->ip){
+    for(uint64 va = a; va < b; va += PGSIZE){
+      pte = walk(p->vm->pagetable, va, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_D) &&
+         vma_writeback(v, va, PTE2PA(*pte)) < 0)
+        r = -1;
+    }
+  }
+  uvmunmap(p->vm->pagetable, a, (b - a) / PGSIZE, 1);
+  return r;
+}
+
+// Remove [addr, addr+len) from p's mmap regions, splitting
+// a region if the range is in the middle of it.
+// Returns 0, or -1 if a region would need splitting and
+// there is no free struct vma, or if a dirty page of a
+// MAP_SHARED file region could not be written back.
+int
+vma_unmap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v, *free = 0;
+  uint64 a, b, end = addr + len;
+  int r = 0;
+
+  if(addr % PGSIZE || end < addr)
+    return -1;
+  end = PGROUNDUP(end);
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++){
+    if(v->start == v->end && free == 0)
+      free = v;
+    // shm segments are only detached whole, and
+    // trapframes not at all.
+    if((v->flags & VMA_SHM) && v->end > addr && v->start < end &&
+       (v->start < addr || v->end > end))
+      return -1;
+    if((v->flags & VMA_TF) && v->end > addr && v->start < end)
+      return -1;
+  }
+
+  for(v = p->vm->vma; v < &p->vm->vma[NVMA]; v++){
+    if((v->flags & VMA_MMAP) == 0 || v->end <= addr || v->start >= end)
+      continue;
+    a = addr > v->start ? addr : v->start;
+    b = end < v->end ? end : v->end;
+    if(a > v->start && b < v->end){
+      // split: the part above b goes in a new region.
+      if(free == 0)
+        return -1;
+      *free = *v;
+      free->start = b;
+      free->off += b - v->start;
+      free->filesz = free->filesz > b - v->start ? free->filesz - (b - v->start) : 0;
+      if(free->ip)
+        idup(free->ip);
+      v->end = b;
+      free = 0;
+    }
+    if(vma_unmappages(p, v, a, b) < 0)
+      r = -1;
+    if(a == v->start && b == v->end){
+      if(v->shm)
+        shmput(v->shm);
+      if(v->ip){
+        begin_op();
+        iput(v->ip);
+        end_op();
+      }
+      memset(v, 0, sizeof(*v));
+    } else if(a == v->start){
+      v->off += b - v->start;
+      v->filesz = v->filesz > b - v->start ? v->filesz - (b - v->start) : 0;
+      v->start = b;
+    } else {
+      v->end = a;
+    }
+  }
+  return r;
+}
+
+// Unmap all of p's mmap regions and release all of
+// its regions, for exit() and exec().
+// Returns 0, or -1 if a dirty page of a MAP_SHARED
+// file region could not be written back.
+int
+vma_release(struct proc *p)
+{
+  int r = 0;
+
+  for(struct vma *v = p->vm->vma; v < &p->vm->vma[NVMA]; v++)
+    if(v->flags & VMA_TF)
+      uvmunmap(p->vm->pagetable, v->start, 1, 0);
+    else if((v->flags & VMA_MMAP) && vma_unmappages(p, v, v->start, v->end) < 0)
+      r = -1;
+  vma_free(p->vm->vma);
+  return r;
+}
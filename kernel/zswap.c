@@ -0,0 +1,559 @@
+//
+// Compressed swap in memory, in the manner of Linux's zram,
+// in front of the swap disk (see swap.c).
+//
+// When free memory runs low, the kswapd process picks cold user
+// pages with a clock scan over the processes' page tables,
+// compresses each with a small LZ77 coder, and keeps the result
+// in a slab cache of the right size. The page's PTE becomes a
+// swap entry: not valid, marked PTE_SWAP, with the address of
+// the compressed copy in place of the physical page number and
+// the page's permissions kept. vmfault() decompresses it into a
+// new page the next time it is touched (see zswap_in()).
+// Pages that do not compress are written to the swap disk
+// instead, a batch at a time.
+//
+// zswap_balance(), called before user pages are allocated,
+// wakes kswapd when free memory falls below ZLOW, and reclaims
+// directly if it falls below ZMIN all the same.
+//
+// The scan gives a second chance to pages whose PTE_A bit the
+// hardware has set since the last pass: it clears the bit and
+// moves on. The TLB is not flushed for this, so a page in
+// constant use may look cold; it then just faults back in.
+//
+// Only private, writable pages with one reference are taken:
+// a process's heap, stack and data, and its MAP_PRIVATE regions.
+// Pages that compress to more than ZMAX bytes go to the swap
+// disk, or stay in memory if there is none; so do all pages
+// once ZPAGES are compressed, as many as there is memory, like
+// the size of a zram disk. Otherwise a program that allocates
+// until it fails, with pages that compress well, would take
+// a long time to fail.
+//
+// A page is taken with its address space's lock held, and freed
+// only once other harts running threads of that address space
+// have trapped (see asid_shootdown()), and while no thread is in
+// copyin() or copyout() (vm->ncopy), which use a page's physical
+// address without holding the lock.
+//
+// After fork(), parent and child share a compressed page until
+// one of them touches it.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "defs.h"
+#include "memstat.h"
+
+#define ZMIN    256          // reclaim directly below this many free pages
+#define ZLOW    512          // wake kswapd when fewer pages than this are free
+#define ZHIGH   1024         // until this many are
+#define ZBATCH  32           // pages taken from an address space at once
+#define ZMAX    (PGSIZE/2)   // most bytes kept for a compressed page
+#define ZHASH   4096         // entries in the compressor's hash table
+#define ZPAGES  ((PHYSTOP - KERNBASE) / PGSIZE)  // most pages kept compressed
+
+#define NZCLASS 9
+static uint zclass[NZCLASS] = { 64, 128, 256, 384, 512, 768, 1024, 1536, 2048 };
+
+// A compressed page.
+struct zpage {
+  int ref;           // swap entries that refer to it
+  ushort len;        // bytes of data
+  uchar class;       // index in zclass[]
+  uchar data[];
+};
+
+// a swap entry keeps the permission bits of the PTE it replaced.
+#define ZPERM (PTE_R|PTE_W|PTE_X|PTE_U)
+#define ZENTRY(zp) (((uint64)(zp) << 10) | PTE_SWAP)
+#define ZPAGE(pte) ((struct zpage*)((pte) >> 10))
+
+extern struct proc proc[NPROC];
+
+// zs.lock is held by the one process reclaiming at a time.
+static struct {
+  struct sleeplock lock;
+  int on;                      // ZSWAP_COMPRESS, ZSWAP_DISK
+  int hand;                    // clock hand: slot in proc[]
+  uint64 va;                   //   and address in its memory
+  struct vmspace *vm;          // address space being scanned
+  pte_t *pte[ZBATCH];          // pages being taken
+  pte_t old[ZBATCH];
+  pte_t new[ZBATCH];           //   their swap entries, or 0 to keep them
+  int busy[ZBATCH];            //   being written to the swap disk?
+  uchar buf[ZMAX];             // compressed page being made
+  ushort hash[ZHASH];          // last position+1 of each 3-byte hash
+} zs;
+
+// zlock protects zpage refs and the counts,
+// and kswapd sleeps on it.
+static struct spinlock zlock;
+static struct {
+  uint64 npages;
+  uint64 nbytes;
+  uint64 nout;
+  uint64 nin;
+} zst;
+
+static struct kmem_cache *zcache[NZCLASS];
+
+static void kswapd(void);
+
+void
+zswapinit(void)
+{
+  static char *names[NZCLASS] = {
+    "zswap64", "zswap128", "zswap256", "zswap384", "zswap512",
+    "zswap768", "zswap1024", "zswap1536", "zswap2048",
+  };
+
+  initsleeplock(&zs.lock, "zswap");
+  initlock(&zlock, "zpage");
+  for(int i = 0; i < NZCLASS; i++)
+    zcache[i] = kmem_cache_create(names[i], zclass[i], 0);
+  zs.on = ZSWAP_COMPRESS|ZSWAP_DISK;
+  kthread("kswapd", kswapd);
+}
+
+// Compress the page at src into dst, LZ77 style: a control
+// byte gives the kind of each of the next eight items, which
+// are either a literal byte or a match of 2 or 3 bytes that
+// copies len bytes from off bytes back:
+//   off[11:4] | off[3:0] len-3 [| len-18 if len-3 is 15]
+// Returns the compressed length, or 0 if it is more than max.
+static int
+lz_compress(uchar *src, uchar *dst, int max)
+{
+  int i = 0, o = 0, bit = 8, cand, off, len;
+  uchar *ctl = 0;
+  uint h;
+
+  memset(zs.hash, 0, sizeof(zs.hash));
+  while(i < PGSIZE){
+    if(bit == 8){
+      if(o >= max)
+        return 0;
+      ctl = &dst[o++];
+      *ctl = 0;
+      bit = 0;
+    }
+    if(i + 3 <= PGSIZE){
+      h = ((src[i] << 16 | src[i+1] << 8 | src[i+2]) * 2654435761U) >> 20;
+      cand = zs.hash[h] - 1;
+      zs.hash[h] = i + 1;
+      if(cand >= 0 && src[cand] == src[i] && src[cand+1] == src[i+1] &&
+         src[cand+2] == src[i+2]){
+        off = i - cand;
+        for(len = 3; i + len < PGSIZE && len < 18+255; len++)
+          if(src[cand+len] != src[i+len])
+            break;
+        if(o + 3 > max)
+          return 0;
+        dst[o++] = off >> 4;
+        if(len - 3 < 15){
+          dst[o++] = (off << 4) | (len - 3);
+        } else {
+          dst[o++] = (off << 4) | 15;
+          dst[o++] = len - 18;
+        }
+        *ctl |= 1 << bit++;
+        i += len;
+        continue;
+      }
+    }
+    if(o >= max)
+      return 0;
+    dst[o++] = src[i++];
+    bit++;
+  }
+  return o;
+}
+
+static void
+lz_decompress(uchar *src, int n, uchar *dst)
+{
+  int i = 0, o = 0, off, len;
+  uchar ctl;
+
+  while(i < n){
+    ctl = src[i++];
+    for(int bit = 0; bit < 8 && i < n; bit++){
+      if(ctl & (1 << bit)){
+        off = src[i] << 4 | src[i+1] >> 4;
+        len = (src[i+1] & 15) + 3;
+        i += 2;
+        if(len == 18)
+          len += src[i++];
+        if(off == 0 || off > o || o + len > PGSIZE)
+          panic("lz_decompress");
+        for(; len > 0; len--, o++)
+          dst[o] = dst[o - off];
+      } else {
+        if(o >= PGSIZE)
+          panic("lz_decompress");
+        dst[o++] = src[i++];
+      }
+    }
+  }
+  if(o != PGSIZE)
+    panic("lz_decompress: short");
+}
+
+// Return a compressed copy of the page at pa, or 0 if it
+// does not compress well enough or there is no memory.
+static struct zpage*
+zcompress(uchar *pa)
+{
+  struct zpage *zp;
+  int n, c;
+
+  if(__atomic_load_n(&zst.npages, __ATOMIC_RELAXED) >= ZPAGES)
+    return 0;
+  if((n = lz_compress(pa, zs.buf, ZMAX - sizeof(struct zpage))) == 0)
+    return 0;
+  for(c = 0; zclass[c] < n + sizeof(struct zpage); c++)
+    ;
+  if((zp = kmem_cache_alloc(zcache[c])) == 0)
+    return 0;
+  zp->ref = 1;
+  zp->len = n;
+  zp->class = c;
+  memmove(zp->data, zs.buf, n);
+
+  acquire(&zlock);
+  zst.npages++;
+  zst.nbytes += zclass[c];
+  zst.nout++;
+  release(&zlock);
+  return zp;
+}
+
+// Drop the reference of swap entry pte to its
+// compressed page or swap slot.
+void
+zswap_drop(pte_t pte)
+{
+  struct zpage *zp = ZPAGE(pte);
+  int last;
+
+  if(pte & PTE_SWAPDISK){
+    swap_drop(pte);
+    return;
+  }
+  acquire(&zlock);
+  if(zp->ref < 1)
+    panic("zswap_drop");
+  last = --zp->ref == 0;
+  if(last){
+    zst.npages--;
+    zst.nbytes -= zclass[zp->class];
+  }
+  release(&zlock);
+  if(last)
+    kmem_cache_free(zcache[zp->class], zp);
+}
+
+// Add a reference to the compressed page or swap slot
+// of swap entry pte, which fork() has copied.
+void
+zswap_dup(pte_t pte)
+{
+  if(pte & PTE_SWAPDISK){
+    swap_dup(pte);
+    return;
+  }
+  acquire(&zlock);
+  ZPAGE(pte)->ref++;
+  release(&zlock);
+}
+
+// Replace the swap entry *pte with a mapping of a new page
+// holding its contents, decompressed or read from disk. Returns the page's physical address,
+// or 0 if out of memory. Caller must hold the address space's
+// lock.
+uint64
+zswap_in(pte_t *pte)
+{
+  pte_t old = *pte;
+  char *mem;
+
+  if(old & PTE_SWAPDISK)
+    return swap_in(pte);
+  if((mem = kalloc()) == 0)
+    return 0;
+  lz_decompress(ZPAGE(old)->data, ZPAGE(old)->len, (uchar*)mem);
+  *pte = PA2PTE(mem) | (old & ZPERM) | PTE_V | PTE_A | PTE_D;
+  zswap_drop(old);
+
+  acquire(&zlock);
+  zst.nin++;
+  release(&zlock);
+  return (uint64)mem;
+}
+
+// May the page that pte maps at va in vm be taken?
+static int
+zswappable(struct vmspace *vm, uint64 va, pte_t pte)
+{
+  struct vma *v;
+
+  if((pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return 0;
+  for(v = vm->vma; v < &vm->vma[NVMA]; v++)
+    if(va >= v->start && va < v->end)
+      return (v->flags & (MAP_SHARED|VMA_SHM|VMA_TF)) == 0;
+  return 1;
+}
+
+// Return the PTE of the first page that pagetable maps at or
+// above *va, and set *va to its address; or 0 if there is none.
+// Skips the parts of the address space that have no page table.
+static pte_t*
+nextpage(pagetable_t pagetable, uint64 *va)
+{
+  uint64 a = *va;
+  pagetable_t pt;
+  pte_t *pte;
+  int level;
+
+  while(a < MAXVA){
+    pt = pagetable;
+    for(level = 2; level > 0; level--){
+      pte = &pt[PX(level, a)];
+      if((*pte & PTE_V) == 0)
+        break;
+      pt = (pagetable_t)PTE2PA(*pte);
+    }
+    if(level > 0){
+      a = (a | ((1L << PXSHIFT(level)) - 1)) + 1;
+      continue;
+    }
+    do {
+      if(pt[PX(0, a)] & PTE_V){
+        *va = a;
+        return &pt[PX(0, a)];
+      }
+      a += PGSIZE;
+    } while(PX(0, a) != 0);
+  }
+  return 0;
+}
+
+// Compress, or write to the swap disk, and free the n pages
+// in zs.pte[] of address space vm, whose lock the caller holds.
+static void
+zswap_out(struct vmspace *vm, int n)
+{
+  uint64 pa;
+  struct zpage *zp;
+  int i;
+
+  // once no hart has them in its TLB, the pages
+  // can no longer change.
+  for(i = 0; i < n; i++)
+    zs.old[i] = __atomic_fetch_and(zs.pte[i], ~PTE_V, __ATOMIC_SEQ_CST);
+  asid_flush(vm, -1);
+  if(__atomic_load_n(&vm->ncopy, __ATOMIC_SEQ_CST) > 0){
+    // a copyin() or copyout() may be using one.
+    for(i = 0; i < n; i++)
+      *zs.pte[i] = zs.old[i];
+    return;
+  }
+  asid_shootdown(vm);
+
+  // start the disk writes together, and wait for
+  // them once all are under way.
+  for(i = 0; i < n; i++){
+    pa = PTE2PA(zs.old[i]);
+    zs.new[i] = 0;
+    zs.busy[i] = 0;
+    if(krefs((void*)pa) != 1)
+      ;
+    else if((zs.on & ZSWAP_COMPRESS) && (zp = zcompress((uchar*)pa)) != 0)
+      zs.new[i] = ZENTRY(zp);
+    else if((zs.on & ZSWAP_DISK) && swap_out((void*)pa, &zs.new[i], &zs.busy[i]) < 0)
+      zs.new[i] = 0;
+    if(zs.new[i] == 0)
+      *zs.pte[i] = zs.old[i];
+  }
+  for(i = 0; i < n; i++){
+    if(zs.new[i] == 0)
+      continue;
+    swap_wait(&zs.busy[i]);
+    *zs.pte[i] = zs.new[i] | (zs.old[i] & ZPERM);
+    kfree((void*)PTE2PA(zs.old[i]));
+  }
+}
+
+// Move the clock hand on to the next process.
+static void
+zswap_next(void)
+{
+  zs.hand = (zs.hand + 1) % NPROC;
+  zs.va = 0;
+}
+
+// Scan the address space of the process under the clock hand
+// from zs.va on, taking the pages that have not been used since
+// the last pass, until enough memory is free.
+static void
+zswap_scan(void)
+{
+  struct proc *p = &proc[zs.hand];
+  struct vmspace *vm = 0;
+  int mine = 0, n = 0;
+  pte_t *pte = 0;
+  uint64 va;
+
+  // vmspace_put() clears p->vm under p->lock, then waits
+  // in zswap_forget() for us to be done with it before
+  // freeing it.
+  acquire(&p->lock);
+  if(p->state == RUNNABLE || p->state == RUNNING || p->state == SLEEPING)
+    vm = p->vm;
+  __atomic_store_n(&zs.vm, vm, __ATOMIC_RELEASE);
+  release(&p->lock);
+  if(vm == 0 || (!(mine = holdingsleep(&vm->lock)) && !tryacquiresleep(&vm->lock))){
+    __atomic_store_n(&zs.vm, 0, __ATOMIC_RELEASE);
+    zswap_next();
+    return;
+  }
+
+  for(va = zs.va; vm->ref > 0 && (pte = nextpage(vm->pagetable, &va)) != 0; va += PGSIZE){
+    if(!zswappable(vm, va, *pte))
+      continue;
+    if(*pte & PTE_A){
+      __atomic_fetch_and(pte, ~PTE_A, __ATOMIC_RELAXED);
+      continue;
+    }
+    zs.pte[n] = pte;
+    if(++n < ZBATCH)
+      continue;
+    zswap_out(vm, n);
+    n = 0;
+    if(kfreepages() >= ZHIGH){
+      zs.va = va + PGSIZE;
+      break;
+    }
+  }
+  if(n > 0)
+    zswap_out(vm, n);
+  if(pte == 0 || vm->ref == 0)
+    zswap_next();
+  if(!mine)
+    releasesleep(&vm->lock);
+  __atomic_store_n(&zs.vm, 0, __ATOMIC_RELEASE);
+}
+
+// vm is about to be freed, and no process refers to it
+// any more. Wait until a scan that found it earlier has
+// finished with it.
+void
+zswap_forget(struct vmspace *vm)
+{
+  if(__atomic_load_n(&zs.vm, __ATOMIC_ACQUIRE) != vm)
+    return;
+  acquiresleep(&zs.lock);
+  releasesleep(&zs.lock);
+}
+
+// Is there anywhere to put cold pages?
+static int
+reclaimable(void)
+{
+  return (zs.on & ZSWAP_COMPRESS) || ((zs.on & ZSWAP_DISK) && swapon());
+}
+
+// Take pages until enough memory is free, for at most
+// two passes over the processes: one to clear PTE_A,
+// and one to take the pages still without it.
+static void
+zswap_reclaim(void)
+{
+  acquiresleep(&zs.lock);
+  for(int i = 0; i < 2*NPROC && kfreepages() < ZHIGH; i++)
+    zswap_scan();
+  releasesleep(&zs.lock);
+}
+
+// The kswapd process, started by zswapinit(). Reclaims
+// whenever zswap_balance() finds free memory low.
+static void
+kswapd(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&zlock);
+    while(kfreepages() >= ZLOW || !reclaimable())
+      sleep(&zs, &zlock);
+    release(&zlock);
+
+    zswap_reclaim();
+    if(kfreepages() < ZLOW){
+      // every page was in use; let them age a tick.
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+    }
+  }
+}
+
+// Wake kswapd if free memory is low, and if it is very
+// low, reclaim here too. Called before allocating user
+// pages, maybe with the current address space's lock held.
+void
+zswap_balance(void)
+{
+  int locked;
+
+  if(myproc() == 0 || kfreepages() >= ZLOW || !reclaimable())
+    return;
+  acquire(&zlock);
+  wakeup(&zs);
+  release(&zlock);
+  if(kfreepages() >= ZMIN)
+    return;
+
+  // reclaim may sleep, so not with a spinlock held,
+  // as in a copyin() from pipewrite().
+  push_off();
+  locked = mycpu()->noff > 1;
+  pop_off();
+  if(!locked)
+    zswap_reclaim();
+}
+
+// Choose what reclaim may do with cold pages: a mask of
+// ZSWAP_COMPRESS and ZSWAP_DISK, or 0 to leave them be,
+// to compare. Pages already swapped stay so until touched.
+// Returns the old setting.
+int
+zswapctl(int on)
+{
+  int old = zs.on;
+
+  zs.on = on & (ZSWAP_COMPRESS|ZSWAP_DISK);
+  return old;
+}
+
+// Fill in the zswap part of a struct memstat.
+void
+zswapstat(struct memstat *st)
+{
+  acquire(&zlock);
+  st->nzswap = zst.npages;
+  st->zsbytes = zst.nbytes;
+  st->zsout = zst.nout;
+  st->zsin = zst.nin;
+  release(&zlock);
+}
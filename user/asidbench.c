@@ -0,0 +1,105 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// System call round trips and context switches, with and
+// without address-space identifiers. Between traps each
+// process touches a page of a working set, so that a TLB
+// flushed on every trap costs page-table walks afterwards.
+//
+//   asidbench [nsyscall] [nswitch]
+
+#define NWS 32   // pages in the working set
+
+static char ws[NWS*PGSIZE];
+
+static void
+touch(int i)
+{
+  ws[(i % NWS) * PGSIZE]++;
+}
+
+static int
+syscalls(int n)
+{
+  int t0 = uptime();
+  for(int i = 0; i < n; i++){
+    getpid();
+    touch(i);
+  }
+  return uptime() - t0;
+}
+
+// n round trips of a byte between two processes over pipes;
+// each trip is two context switches.
+static int
+switches(int n)
+{
+  int ping[2], pong[2], t0;
+  char c = 0;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf("asidbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    for(int i = 0; i < n; i++){
+      if(read(ping[0], &c, 1) != 1)
+        exit(1);
+      touch(i);
+      write(pong[1], &c, 1);
+    }
+    exit(0);
+  }
+  for(int i = 0; i < n; i++){
+    write(ping[1], &c, 1);
+    if(read(pong[0], &c, 1) != 1){
+      printf("asidbench: read failed\n");
+      exit(1);
+    }
+    touch(i);
+  }
+  wait(0);
+  t0 = uptime() - t0;
+  close(ping[0]);
+  close(ping[1]);
+  close(pong[0]);
+  close(pong[1]);
+  return t0;
+}
+
+static void
+run(char *what, int nsyscall, int nswitch)
+{
+  printf("%s:\n", what);
+  printf("  %d system calls: %d ticks\n", nsyscall, syscalls(nsyscall));
+  printf("  %d pipe round trips: %d ticks\n", nswitch, switches(nswitch));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nsyscall = 200000, nswitch = 10000;
+
+  if(argc > 1)
+    nsyscall = atoi(argv[1]);
+  if(argc > 2)
+    nswitch = atoi(argv[2]);
+
+  for(int i = 0; i < NWS; i++)
+    touch(i);
+
+  int old = asidctl(0);
+  if(old < 0){
+    printf("asidbench: no ASIDs on this hardware\n");
+    run("without ASIDs", nsyscall, nswitch);
+    exit(0);
+  }
+  run("without ASIDs", nsyscall, nswitch);
+  asidctl(1);
+  run("with ASIDs", nsyscall, nswitch);
+  asidctl(old);
+  exit(0);
+}
@@ -0,0 +1,121 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Reads a set of files over and over the way cat and wc do,
+// 512 bytes at a time, counting lines, words and bytes, to
+// show the buffer cache growing to hold them. A file can be
+// no larger than MAXFILE blocks, so the working set is made
+// of several. Each pass reports its rate, the fraction of
+// bread()s the cache served, and how many buffers it has.
+// A tick is about a tenth of a second.
+//
+//   bcachebench [files [passes]]
+
+#define FILEBYTES (MAXFILE*BSIZE)
+
+static char buf[512];
+
+static void
+mkfile(char *path)
+{
+  int fd, i, n;
+
+  if((fd = open(path, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("bcachebench: create %s failed\n", path);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = (i % 64) == 63 ? '\n' : (i % 8) == 7 ? ' ' : 'a' + i % 26;
+  for(n = 0; n < FILEBYTES; n += sizeof(buf))
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bcachebench: write %s failed\n", path);
+      exit(1);
+    }
+  close(fd);
+}
+
+// wc's loop, less the printing; returns the bytes read.
+static int
+wc(char *path, int *lines, int *words)
+{
+  int fd, n, i, inword = 0, total = 0;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    printf("bcachebench: open %s failed\n", path);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    total += n;
+    for(i = 0; i < n; i++){
+      if(buf[i] == '\n')
+        (*lines)++;
+      if(strchr(" \r\t\n\v", buf[i]))
+        inword = 0;
+      else if(!inword){
+        (*words)++;
+        inword = 1;
+      }
+    }
+  }
+  close(fd);
+  return total;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[] = "bcache0";
+  struct memstat st0, st1;
+  int nfile = 3, passes = 4, i, p, t0, t, kb, lines, words;
+  uint64 hit, miss;
+
+  if(argc > 1)
+    nfile = atoi(argv[1]);
+  if(argc > 2)
+    passes = atoi(argv[2]);
+  if(nfile < 1 || nfile > 10){
+    printf("bcachebench: 1 to 10 files\n");
+    exit(1);
+  }
+
+  for(i = 0; i < nfile; i++){
+    path[6] = '0' + i;
+    mkfile(path);
+  }
+  printf("%d files of %d KB:\n", nfile, (int)(FILEBYTES / 1024));
+
+  for(p = 0; p < passes; p++){
+    if(memstat(&st0) < 0){
+      printf("bcachebench: memstat failed\n");
+      exit(1);
+    }
+    t0 = uptime();
+    kb = lines = words = 0;
+    for(i = 0; i < nfile; i++){
+      path[6] = '0' + i;
+      kb += wc(path, &lines, &words) / 1024;
+    }
+    t = uptime() - t0;
+    memstat(&st1);
+
+    hit = st1.bhit - st0.bhit;
+    miss = st1.bmiss - st0.bmiss;
+    printf("  pass %d: %d KB, %d lines, %d words in %d ticks",
+           p, kb, lines, words, t);
+    if(t > 0)
+      printf(", %d KB/s", kb * 10 / t);
+    if(hit + miss > 0)
+      printf(", %d%% hits", (int)(hit * 100 / (hit + miss)));
+    printf(", %d buffers\n", (int)st1.nbuf);
+  }
+
+  for(i = 0; i < nfile; i++){
+    path[6] = '0' + i;
+    unlink(path);
+  }
+  exit(0);
+}
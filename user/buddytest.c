@@ -0,0 +1,116 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Randomized stress test for the buddy allocator in kalloc.c.
+// Allocates and frees blocks of random order through the
+// buddytest() system call, which fills every block with a
+// per-block pattern and checks it on free, so overlapping
+// allocations are caught. At the end every block is freed
+// and the number of free pages must be back where it started.
+//
+//   buddytest [iterations]
+
+#define NHELD 64
+
+static unsigned long seed = 12345;
+
+static int
+rand(void)
+{
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 16) & 0x7fff;
+}
+
+// orders are skewed towards small blocks, as in the kernel.
+static int
+randorder(void)
+{
+  int order = 0;
+  while(order < MAXORDER && (rand() & 1))
+    order++;
+  return order;
+}
+
+// fraction (in percent) of free memory that is not in the
+// largest free block; 0 means free memory is one block.
+static int
+fragmentation(struct memstat *st)
+{
+  int k;
+  for(k = MAXORDER; k > 0 && st->nblocks[k] == 0; k--)
+    ;
+  if(st->nfree == 0)
+    return 0;
+  return 100 - (int)((100L << k) / st->nfree);
+}
+
+static void
+report(char *when, struct memstat *st)
+{
+  printf("%s: %ld free of %ld pages, fragmentation %d%%\n",
+         when, st->nfree, st->npages, fragmentation(st));
+  printf("  free blocks by order:");
+  for(int k = 0; k <= MAXORDER; k++)
+    printf(" %ld", st->nblocks[k]);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st0, st1, st;
+  int held[NHELD];
+  int nheld = 0, iters = 20000, nalloc = 0, nfail = 0;
+
+  if(argc > 1)
+    iters = atoi(argv[1]);
+
+  if(memstat(&st0) < 0){
+    printf("buddytest: memstat failed\n");
+    exit(1);
+  }
+  report("start", &st0);
+
+  for(int i = 0; i < iters; i++){
+    if(nheld < NHELD && (nheld == 0 || rand() % 3 != 0)){
+      int slot = buddytest(BT_ALLOC, randorder());
+      if(slot < 0){
+        nfail++;
+        continue;
+      }
+      held[nheld++] = slot;
+      nalloc++;
+    } else {
+      int j = rand() % nheld;
+      if(buddytest(BT_FREE, held[j]) < 0){
+        printf("buddytest: block in slot %d was corrupted\n", held[j]);
+        buddytest(BT_RESET, 0);
+        exit(1);
+      }
+      held[j] = held[--nheld];
+    }
+    if(i == iters / 2){
+      memstat(&st);
+      report("midway", &st);
+    }
+  }
+
+  if(buddytest(BT_RESET, 0) < 0){
+    printf("buddytest: corrupted block found on reset\n");
+    exit(1);
+  }
+
+  memstat(&st1);
+  report("end", &st1);
+  printf("%d allocations, %d failed, %ld splits, %ld merges\n",
+         nalloc, nfail, st1.nsplit - st0.nsplit, st1.nmerge - st0.nmerge);
+
+  if(st1.nfree != st0.nfree){
+    printf("buddytest: FAILED, lost %ld pages\n", st0.nfree - st1.nfree);
+    exit(1);
+  }
+  printf("buddytest: OK\n");
+  exit(0);
+}
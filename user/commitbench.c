@@ -0,0 +1,102 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Log commit latency and large-write throughput. Small
+// commits are one-byte write()s, each its own transaction,
+// timed with each diskpoll() setting; the large writes fill
+// a file of MAXFILE blocks over and over. Each reports how
+// many blocks went to the disk per request, from memstat().
+// A tick is about a tenth of a second.
+//
+//   commitbench [commits [files]]
+
+static char buf[8*BSIZE];
+
+static void
+report(struct memstat *st0, struct memstat *st1)
+{
+  uint64 req = st1->breq - st0->breq, blk = st1->breqblk - st0->breqblk;
+
+  printf(", %d disk requests", (int)req);
+  if(req > 0)
+    printf(", %d.%d blocks each", (int)(blk / req), (int)(blk * 10 / req % 10));
+  printf("\n");
+}
+
+static void
+small(int ncommit, char *what)
+{
+  struct memstat st0, st1;
+  int fd, i, t0, t;
+
+  if((fd = open("commitbench.tmp", O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("commitbench: create failed\n");
+    exit(1);
+  }
+  memstat(&st0);
+  t0 = uptime();
+  for(i = 0; i < ncommit; i++)
+    if(write(fd, "x", 1) != 1){
+      printf("commitbench: write failed\n");
+      exit(1);
+    }
+  t = uptime() - t0;
+  memstat(&st1);
+  close(fd);
+  printf("%d small commits, %s, in %d ticks", ncommit, what, t);
+  if(ncommit > 0)
+    printf(", %d us each", t * 100000 / ncommit);
+  printf(", %d polls", (int)(st1.dpoll - st0.dpoll));
+  report(&st0, &st1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st0, st1;
+  int ncommit = 200, nfile = 4, fd, i, n, m, t0, t, kb, old;
+
+  if(argc > 1)
+    ncommit = atoi(argv[1]);
+  if(argc > 2)
+    nfile = atoi(argv[2]);
+
+  old = diskpoll(DISKPOLL_OFF);
+  small(ncommit, "sleeping");
+  diskpoll(DISKPOLL_SYNC);
+  small(ncommit, "polling for commits");
+  diskpoll(DISKPOLL_ALL);
+  small(ncommit, "polling for all");
+  diskpoll(old);
+
+  memstat(&st0);
+  t0 = uptime();
+  for(i = 0; i < nfile; i++){
+    if((fd = open("commitbench.tmp", O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+      printf("commitbench: create failed\n");
+      exit(1);
+    }
+    for(n = 0; n < MAXFILE*BSIZE; n += m){
+      m = MAXFILE*BSIZE - n < sizeof(buf) ? MAXFILE*BSIZE - n : sizeof(buf);
+      if(write(fd, buf, m) != m){
+        printf("commitbench: write failed\n");
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  t = uptime() - t0;
+  memstat(&st1);
+  kb = nfile * (MAXFILE*BSIZE / 1024);
+  printf("%d KB of large writes in %d ticks", kb, t);
+  if(t > 0)
+    printf(", %d KB/s", kb * 10 / t);
+  report(&st0, &st1);
+
+  unlink("commitbench.tmp");
+  exit(0);
+}
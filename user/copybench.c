@@ -0,0 +1,135 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// Bulk read() and write() through a pipe and a file, which
+// is mostly the kernel's copyin() and copyout(). The pipe
+// moves 1 MB per write() call, to a child that reads it back
+// and checks it. A file can be no larger than MAXFILE blocks,
+// so the file is written and read whole, over and over. A
+// tick is about a tenth of a second.
+//
+//   copybench [megabytes]
+
+#define MB (1024*1024)
+#define FILEBYTES (MAXFILE*BSIZE)
+
+static char *buf;
+static char *rbuf;
+
+static void
+report(char *what, int kb, int t)
+{
+  printf("  %s: %d KB in %d ticks", what, kb, t);
+  if(t > 0)
+    printf(", %d KB/s", kb * 10 / t);
+  printf("\n");
+}
+
+static void
+pipebench(int mb)
+{
+  int fds[2], pid, xstatus, t0, n, i, k;
+
+  if(pipe(fds) < 0){
+    printf("copybench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  if((pid = fork()) < 0){
+    printf("copybench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    for(i = 0; i < mb; i++){
+      for(k = 0; k < MB; k += n){
+        if((n = read(fds[0], rbuf + k, MB - k)) <= 0){
+          printf("copybench: pipe read failed\n");
+          exit(1);
+        }
+      }
+      if(memcmp(rbuf, buf, MB) != 0){
+        printf("copybench: pipe data came back wrong\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[0]);
+  for(i = 0; i < mb; i++){
+    if(write(fds[1], buf, MB) != MB){
+      printf("copybench: pipe write failed\n");
+      exit(1);
+    }
+  }
+  close(fds[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  report("pipe", mb * 1024, uptime() - t0);
+}
+
+static void
+filebench(int mb)
+{
+  int fd, t0, i, nfile = (mb * MB + FILEBYTES - 1) / FILEBYTES;
+
+  t0 = uptime();
+  for(i = 0; i < nfile; i++){
+    if((fd = open("copybench.tmp", O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+      printf("copybench: create failed\n");
+      exit(1);
+    }
+    if(write(fd, buf, FILEBYTES) != FILEBYTES){
+      printf("copybench: file write failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  report("file write", nfile * (FILEBYTES / 1024), uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < nfile; i++){
+    if((fd = open("copybench.tmp", O_RDONLY)) < 0){
+      printf("copybench: open failed\n");
+      exit(1);
+    }
+    if(read(fd, rbuf, FILEBYTES) != FILEBYTES){
+      printf("copybench: file read failed\n");
+      exit(1);
+    }
+    close(fd);
+    if(memcmp(rbuf, buf, FILEBYTES) != 0){
+      printf("copybench: file data came back wrong\n");
+      exit(1);
+    }
+  }
+  report("file read", nfile * (FILEBYTES / 1024), uptime() - t0);
+  unlink("copybench.tmp");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 8;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+
+  buf = malloc(MB);
+  rbuf = malloc(MB);
+  if(buf == 0 || rbuf == 0){
+    printf("copybench: out of memory\n");
+    exit(1);
+  }
+  for(int i = 0; i < MB; i++)
+    buf[i] = i * 7 + (i >> 10);
+
+  printf("copying %d MB in 1 MB read() and write() calls:\n", mb);
+  pipebench(mb);
+  filebench(mb);
+  exit(0);
+}
@@ -0,0 +1,62 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Exec latency benchmark. Runs a small program (this one)
+// and a large one (usertests) count times each, with an
+// argument that makes them exit as soon as they reach
+// main(), so the time measured is that from exec() to the
+// program's first instructions, plus fork, exit and wait.
+//
+//   execbench [count]
+
+static int
+run(char *path, int count)
+{
+  char *argv[] = { path, "-x", 0 };
+  struct stat st;
+  int t0;
+
+  if(stat(path, &st) < 0){
+    printf("execbench: cannot stat %s\n", path);
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(int i = 0; i < count; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("execbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);  // usertests prints its usage message
+      exec(path, argv);
+      exit(2);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus == 2){
+      printf("execbench: exec %s failed\n", path);
+      exit(1);
+    }
+  }
+  int t = uptime() - t0;
+  printf("%s (%d bytes): %d execs in %d ticks\n", path, (int)st.size, count, t);
+  return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int count = 200;
+
+  if(argc == 2 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc > 1)
+    count = atoi(argv[1]);
+
+  run("execbench", count);
+  run("usertests", count);
+  exit(0);
+}
@@ -0,0 +1,94 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Parallel file system throughput, in the manner of stressfs
+// and logstress: nproc processes each write a file of their
+// own and read it back several times, round after round. The
+// reads mostly hit the buffer cache, so with more harts
+// (make CPUS=n qemu) they show how well its locking scales.
+// A tick is about a tenth of a second.
+//
+//   fsbench [nproc [rounds]]
+
+#define NWRITE 8       // 512-byte writes per round
+#define NREAD 4        // times each round reads the file back
+
+static char data[512];
+
+static void
+worker(int id, int rounds)
+{
+  char path[] = "fsbench0";
+  int fd, r, i, k;
+
+  path[7] += id;
+  memset(data, 'a' + id, sizeof(data));
+  for(r = 0; r < rounds; r++){
+    if((fd = open(path, O_CREATE|O_TRUNC|O_RDWR)) < 0){
+      printf("fsbench: create %s failed\n", path);
+      exit(1);
+    }
+    for(i = 0; i < NWRITE; i++)
+      if(write(fd, data, sizeof(data)) != sizeof(data)){
+        printf("fsbench: write failed\n");
+        exit(1);
+      }
+    close(fd);
+
+    for(k = 0; k < NREAD; k++){
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf("fsbench: open %s failed\n", path);
+        exit(1);
+      }
+      for(i = 0; i < NWRITE; i++)
+        if(read(fd, data, sizeof(data)) != sizeof(data) || data[0] != 'a' + id){
+          printf("fsbench: read failed\n");
+          exit(1);
+        }
+      close(fd);
+    }
+  }
+  unlink(path);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 4, rounds = 50, i, t0, t, xstatus, kb;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(nproc < 1 || nproc > 10){
+    printf("fsbench: 1 to 10 processes\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fsbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker(i, rounds);
+  }
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  t = uptime() - t0;
+
+  kb = nproc * rounds * NWRITE * (1 + NREAD) / 2;
+  printf("%d procs, %d rounds: %d KB in %d ticks", nproc, rounds, kb, t);
+  if(t > 0)
+    printf(", %d KB/s", kb * 10 / t);
+  printf("\n");
+  exit(0);
+}
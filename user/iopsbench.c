@@ -0,0 +1,150 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Random reads from the disk by several processes at once.
+// Each read maps a random file and touches a random page of
+// it, which the page fault reads a block at a time, so that
+// each process has one request in flight, as in mmapbench;
+// the files together are larger than the buffer cache grows.
+// Run it under make CPUS=1 qemu up to CPUS=8: with a
+// virtqueue for each hart, the rate should grow with them.
+// A tick is about a tenth of a second.
+//
+//   iopsbench [reads-per-process]
+
+#define NFILE 20                // files, of MAXFILE blocks
+#define FILEBYTES (MAXFILE*BSIZE)
+#define NPAGE (FILEBYTES/PGSIZE)
+
+static unsigned long seed;
+
+static int
+rand(void)
+{
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 16) & 0x7fff;
+}
+
+static void
+name(char *path, int i)
+{
+  strcpy(path, "iops00");
+  path[4] = '0' + i / 10;
+  path[5] = '0' + i % 10;
+}
+
+static void
+mkfile(int i)
+{
+  static char buf[BSIZE];
+  char path[8];
+  int fd, n;
+
+  name(path, i);
+  if((fd = open(path, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("iopsbench: create %s failed\n", path);
+    exit(1);
+  }
+  memset(buf, 'a' + i, sizeof(buf));
+  for(n = 0; n < FILEBYTES; n += BSIZE)
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("iopsbench: write %s failed\n", path);
+      exit(1);
+    }
+  close(fd);
+}
+
+static void
+worker(int id, int nread)
+{
+  char path[8];
+  int k, i, fd;
+  char *p;
+
+  seed = id + 1;
+  for(k = 0; k < nread; k++){
+    i = rand() % NFILE;
+    name(path, i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("iopsbench: open %s failed\n", path);
+      exit(1);
+    }
+    p = mmap(0, FILEBYTES, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == (char*)-1){
+      printf("iopsbench: mmap failed\n");
+      exit(1);
+    }
+    if(p[(rand() % NPAGE) * PGSIZE] != 'a' + i){
+      printf("iopsbench: %s came back wrong\n", path);
+      exit(1);
+    }
+    munmap(p, FILEBYTES);
+  }
+  exit(0);
+}
+
+static void
+run(int nproc, int nread)
+{
+  struct memstat st0, st1;
+  int i, t0, t, xstatus, nblk, nreq, nmiss;
+
+  memstat(&st0);
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("iopsbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker(i, nread);
+  }
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  t = uptime() - t0;
+  memstat(&st1);
+
+  nblk = nproc * nread * (PGSIZE / BSIZE);
+  nreq = st1.breq - st0.breq;
+  nmiss = st1.bmiss - st0.bmiss;
+  printf("  %d procs: %d reads in %d ticks", nproc, nproc * nread, t);
+  if(t > 0)
+    printf(", %d reads/s, %d disk requests/s", nproc * nread * 10 / t, nreq * 10 / t);
+  printf(", %d%% of blocks from disk\n", nmiss * 100 / nblk);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int nprocs[] = { 1, 2, 4, 8 };
+  struct memstat st;
+  int nread = 200, i;
+
+  if(argc > 1)
+    nread = atoi(argv[1]);
+
+  for(i = 0; i < NFILE; i++)
+    mkfile(i);
+  memstat(&st);
+  printf("random %d-byte reads from %d files, %d disk queues:\n",
+         PGSIZE, NFILE, st.dnq);
+  for(i = 0; i < sizeof(nprocs)/sizeof(nprocs[0]); i++)
+    run(nprocs[i], nread);
+
+  for(i = 0; i < NFILE; i++){
+    char path[8];
+    name(path, i);
+    unlink(path);
+  }
+  exit(0);
+}
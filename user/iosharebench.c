@@ -0,0 +1,165 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// How the disk's bandwidth is divided between two tenants
+// with different lottery tickets (see iosched.c). Each runs
+// NREADER processes with its tickets, which read its files
+// front to back for the same few seconds; together the files
+// are larger than the buffer cache grows, so the reads go to
+// the disk. The scheduler only divides the disk once its
+// virtqueues are full, so there are enough readers, with
+// readahead, to keep more requests waiting than the disk
+// holds; "queued" counts the requests that found it full.
+// Each tenant's share of the blocks read should then follow
+// its share of the tickets. Run it with CPUS=1, so that
+// there is one virtqueue to fill. A tick is about a tenth
+// of a second.
+//
+//   iosharebench [ticks-per-case]
+
+#define NFILE 5                 // files per tenant, of MAXFILE blocks
+#define NREADER 24              // processes per tenant
+#define FILEBYTES (MAXFILE*BSIZE)
+
+static char buf[8*BSIZE];
+
+static void
+name(char *path, int who, int i)
+{
+  strcpy(path, "ioshare00");
+  path[7] = '0' + who;
+  path[8] = '0' + i;
+}
+
+static void
+mkfile(int who, int i)
+{
+  char path[10];
+  int fd, n;
+
+  name(path, who, i);
+  if((fd = open(path, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("iosharebench: create %s failed\n", path);
+    exit(1);
+  }
+  for(n = 0; n < FILEBYTES; n += BSIZE)
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("iosharebench: write %s failed\n", path);
+      exit(1);
+    }
+  close(fd);
+}
+
+// read who's files, from file i on, from tick start until
+// tick end, and write who and the KB read to fd.
+static void
+reader(int who, int i, int tickets, int start, int end, int fd)
+{
+  char path[10];
+  int n, f, rec[2];
+
+  if(settickets(tickets) < 0){
+    printf("iosharebench: settickets failed\n");
+    exit(1);
+  }
+  rec[0] = who;
+  rec[1] = 0;
+  pause(start - uptime());
+  for(i %= NFILE; uptime() < end; i = (i + 1) % NFILE){
+    name(path, who, i);
+    if((f = open(path, O_RDONLY)) < 0){
+      printf("iosharebench: open %s failed\n", path);
+      exit(1);
+    }
+    while(uptime() < end && (n = read(f, buf, sizeof(buf))) > 0)
+      rec[1] += n / 1024;
+    close(f);
+  }
+  write(fd, rec, sizeof(rec));
+  exit(0);
+}
+
+static void
+run(int ta, int tb, int ticks)
+{
+  struct memstat st0, st1;
+  int fds[2], kb[2], tickets[2], rec[2], who, i, start, xstatus;
+
+  tickets[0] = ta;
+  tickets[1] = tb;
+  if(pipe(fds) < 0){
+    printf("iosharebench: pipe failed\n");
+    exit(1);
+  }
+  memstat(&st0);
+  start = uptime() + 2;
+  for(i = 0; i < 2*NREADER; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("iosharebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      reader(i % 2, i / 2, tickets[i % 2], start, start + ticks, fds[1]);
+  }
+  close(fds[1]);
+  for(i = 0; i < 2*NREADER; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  memstat(&st1);
+  kb[0] = kb[1] = 0;
+  for(i = 0; i < 2*NREADER; i++){
+    if(read(fds[0], rec, sizeof(rec)) != sizeof(rec) || rec[0] < 0 || rec[0] > 1){
+      printf("iosharebench: no counts\n");
+      exit(1);
+    }
+    kb[rec[0]] += rec[1];
+  }
+  close(fds[0]);
+
+  printf("  tickets %d:%d -> KB/s", ta, tb);
+  for(who = 0; who < 2; who++)
+    printf(" %d", kb[who] * 10 / ticks);
+  if(kb[0] + kb[1] > 0)
+    printf(", shares %d%%:%d%%", kb[0] * 100 / (kb[0] + kb[1]),
+           kb[1] * 100 / (kb[0] + kb[1]));
+  printf(" (tickets %d%%:%d%%)", ta * 100 / (ta + tb), tb * 100 / (ta + tb));
+  printf(", %d merged, %d queued\n", (int)(st1.iomerge - st0.iomerge),
+         (int)(st1.ioqueued - st0.ioqueued));
+}
+
+int
+main(int argc, char *argv[])
+{
+  static int cases[][2] = { { 1, 1 }, { 1, 2 }, { 1, 4 }, { 4, 1 } };
+  int ticks = 30, i, who;
+
+  if(argc > 1)
+    ticks = atoi(argv[1]);
+  if(ticks < 1){
+    printf("iosharebench: ticks must be positive\n");
+    exit(1);
+  }
+
+  for(who = 0; who < 2; who++)
+    for(i = 0; i < NFILE; i++)
+      mkfile(who, i);
+  printf("two tenants of %d readers and %d files each, %d ticks per case:\n",
+         NREADER, NFILE, ticks);
+  for(i = 0; i < sizeof(cases)/sizeof(cases[0]); i++)
+    run(cases[i][0], cases[i][1], ticks);
+
+  for(who = 0; who < 2; who++)
+    for(i = 0; i < NFILE; i++){
+      char path[10];
+      name(path, who, i);
+      unlink(path);
+    }
+  exit(0);
+}
@@ -0,0 +1,84 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// malloc() and free() with a mix of sizes. Keeps NSLOT
+// blocks live at random; each step frees a random slot's
+// block, if it has one, or allocates into it. Every block is
+// filled with a byte that is checked when it is freed.
+//
+// The small run uses sizes up to 128 bytes; the mixed run
+// makes one block in eight up to 16 KB, which fragments a
+// first-fit heap.
+//
+//   mallocbench [steps]
+
+#define NSLOT 1024
+
+static char *slot[NSLOT];
+static uint size[NSLOT];
+static unsigned long seed = 1;
+
+static uint
+rand(void)
+{
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 16) & 0x7fff;
+}
+
+static void
+release(int i)
+{
+  for(uint j = 0; j < size[i]; j += 64)
+    if(slot[i][j] != (char)i){
+      printf("mallocbench: block %d was overwritten\n", i);
+      exit(1);
+    }
+  free(slot[i]);
+  slot[i] = 0;
+}
+
+static int
+run(char *what, int steps, uint bigsize)
+{
+  int t0 = uptime();
+
+  seed = 1;
+  for(int s = 0; s < steps; s++){
+    int i = rand() % NSLOT;
+    if(slot[i]){
+      release(i);
+      continue;
+    }
+    uint n = 1 + rand() % 128;
+    if(bigsize && rand() % 8 == 0)
+      n = 1 + rand() % bigsize;
+    if((slot[i] = malloc(n)) == 0){
+      printf("mallocbench: out of memory\n");
+      exit(1);
+    }
+    size[i] = n;
+    for(uint j = 0; j < n; j += 64)
+      slot[i][j] = i;
+  }
+  for(int i = 0; i < NSLOT; i++)
+    if(slot[i])
+      release(i);
+  int t = uptime() - t0;
+  printf("  %s: %d steps in %d ticks\n", what, steps, t);
+  return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int steps = 1000000;
+
+  if(argc > 1)
+    steps = atoi(argv[1]);
+
+  printf("malloc/free with %d live blocks:\n", NSLOT);
+  run("small", steps, 0);
+  run("mixed", steps, 16*1024);
+  exit(0);
+}
@@ -0,0 +1,131 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// memset(), memmove() and memcmp() from ulib.c, which work a
+// word at a time, against plain byte loops, across sizes and
+// alignments. Each case moves the same number of bytes; the
+// rate is in KB per second, and a tick is about a tenth of a
+// second.
+//
+//   membench [megabytes-per-case]
+
+#define BUFSZ (64*1024 + 64)
+
+static char *src, *dst;
+
+static void
+bytemove(char *d, const char *s, uint n)
+{
+  if(s > d){
+    while(n-- > 0)
+      *d++ = *s++;
+  } else {
+    d += n;
+    s += n;
+    while(n-- > 0)
+      *--d = *--s;
+  }
+}
+
+static void
+byteset(char *d, int c, uint n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static int
+bytecmp(const char *a, const char *b, uint n)
+{
+  for(; n > 0; n--, a++, b++)
+    if(*a != *b)
+      return *a - *b;
+  return 0;
+}
+
+enum { MOVE, SET, CMP };
+
+// Run op on size bytes at the given offsets into the buffers
+// until mb megabytes have gone by; return the ticks it took.
+static int
+run(int op, int word, uint size, int doff, int soff, int mb)
+{
+  uint64 total = (uint64)mb * 1024 * 1024, done;
+  char *d = dst + doff, *s = src + soff;
+  volatile int r = 0;
+  int t0;
+
+  // memcmp() runs to the end only of equal bytes.
+  if(op == CMP)
+    memmove(d, s, size);
+  t0 = uptime();
+  for(done = 0; done < total; done += size){
+    switch(op){
+    case MOVE:
+      if(word)
+        memmove(d, s, size);
+      else
+        bytemove(d, s, size);
+      break;
+    case SET:
+      if(word)
+        memset(d, done, size);
+      else
+        byteset(d, done, size);
+      break;
+    case CMP:
+      if(word)
+        r += memcmp(d, s, size);
+      else
+        r += bytecmp(d, s, size);
+      break;
+    }
+  }
+  return uptime() - t0;
+}
+
+static void
+rate(int kb, int t)
+{
+  if(t > 0)
+    printf(" %d KB/s", kb * 10 / t);
+  else
+    printf(" >%d KB/s", kb * 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char *opname[] = { "memmove", "memset", "memcmp" };
+  static uint sizes[] = { 16, 256, 4096, 65536 };
+  static int offs[][2] = { { 0, 0 }, { 3, 3 }, { 0, 3 } };
+  int mb = 16;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  src = malloc(BUFSZ);
+  dst = malloc(BUFSZ);
+  if(src == 0 || dst == 0){
+    printf("membench: out of memory\n");
+    exit(1);
+  }
+  for(int i = 0; i < BUFSZ; i++)
+    src[i] = dst[i] = i;
+
+  printf("%d MB per case, word-wide vs byte loop:\n", mb);
+  for(int op = MOVE; op <= CMP; op++){
+    for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+      for(int j = 0; j < sizeof(offs)/sizeof(offs[0]); j++){
+        if(op == SET && offs[j][1] != 0)
+          continue;
+        printf("  %s %d +%d/+%d:", opname[op], sizes[i], offs[j][0], offs[j][1]);
+        rate(mb * 1024, run(op, 1, sizes[i], offs[j][0], offs[j][1], mb));
+        printf(" vs");
+        rate(mb * 1024, run(op, 0, sizes[i], offs[j][0], offs[j][1], mb));
+        printf("\n");
+      }
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,120 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// Random reads from a large file, via read() and via mmap().
+// There is no lseek(), so a reader that wants random access
+// has to read() the whole file into memory first; with mmap()
+// only the pages that are looked at are brought in.
+//
+// Each round looks up nlookup random 8-byte records; the file
+// is read or mapped afresh each round.
+//
+//   mmapbench [rounds] [nlookup]
+
+#define FILE "mmapbench.tmp"
+#define FILESZ (128*1024)
+
+static unsigned long seed = 1;
+
+static int
+rand(void)
+{
+  seed = seed * 1664525 + 1013904223;
+  return (seed >> 16) & 0x7fff;
+}
+
+static void
+makefile(void)
+{
+  static uint64 buf[PGSIZE/8];
+  int fd;
+
+  unlink(FILE);
+  if((fd = open(FILE, O_CREATE|O_RDWR)) < 0){
+    printf("mmapbench: cannot create %s\n", FILE);
+    exit(1);
+  }
+  for(int off = 0; off < FILESZ; off += PGSIZE){
+    for(int i = 0; i < PGSIZE/8; i++)
+      buf[i] = off/8 + i;
+    if(write(fd, buf, PGSIZE) != PGSIZE){
+      printf("mmapbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+static uint64
+lookups(uint64 *recs, int n)
+{
+  uint64 sum = 0;
+
+  for(int i = 0; i < n; i++){
+    int r = rand() % (FILESZ/8);
+    if(recs[r] != r){
+      printf("mmapbench: record %d is %ld\n", r, recs[r]);
+      exit(1);
+    }
+    sum += recs[r];
+  }
+  return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 50, nlookup = 16;
+  int t0, tread, tmmap;
+  uint64 *buf;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(argc > 2)
+    nlookup = atoi(argv[2]);
+
+  makefile();
+  if((buf = malloc(FILESZ)) == 0){
+    printf("mmapbench: out of memory\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(int i = 0; i < rounds; i++){
+    int fd = open(FILE, O_RDONLY);
+    for(int off = 0; off < FILESZ; off += PGSIZE)
+      if(read(fd, (char*)buf + off, PGSIZE) != PGSIZE){
+        printf("mmapbench: read failed\n");
+        exit(1);
+      }
+    close(fd);
+    lookups(buf, nlookup);
+  }
+  tread = uptime() - t0;
+
+  t0 = uptime();
+  for(int i = 0; i < rounds; i++){
+    int fd = open(FILE, O_RDONLY);
+    uint64 *p = mmap(0, FILESZ, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == (uint64*)-1){
+      printf("mmapbench: mmap failed\n");
+      exit(1);
+    }
+    lookups(p, nlookup);
+    munmap(p, FILESZ);
+  }
+  tmmap = uptime() - t0;
+
+  printf("%d rounds of %d random reads from a %d-byte file:\n",
+         rounds, nlookup, FILESZ);
+  printf("  read(): %d ticks\n", tread);
+  printf("  mmap(): %d ticks\n", tmmap);
+
+  free(buf);
+  unlink(FILE);
+  exit(0);
+}
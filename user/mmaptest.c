@@ -0,0 +1,315 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// Tests for mmap() and munmap(): private and shared file
+// mappings, anonymous mappings, partial unmapping, what
+// fork() does with each kind, and two processes mapping
+// the same file.
+
+#define FILE "mmaptest.tmp"
+#define FILESZ (2*PGSIZE + PGSIZE/2)
+
+static int failed;
+
+static void
+fail(char *msg)
+{
+  printf("mmaptest: FAILED: %s\n", msg);
+  failed = 1;
+}
+
+static char
+pattern(int i)
+{
+  return 'a' + i % 23;
+}
+
+static void
+makefile(void)
+{
+  char buf[512];
+  int fd;
+
+  unlink(FILE);
+  if((fd = open(FILE, O_CREATE|O_RDWR)) < 0){
+    fail("create");
+    exit(1);
+  }
+  for(int off = 0; off < FILESZ; off += sizeof(buf)){
+    for(int i = 0; i < sizeof(buf); i++)
+      buf[i] = pattern(off + i);
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fail("write");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// return the byte at off in the file.
+static char
+fileat(int off)
+{
+  static char buf[PGSIZE];
+  int fd, n, pos = 0;
+
+  fd = open(FILE, O_RDONLY);
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(off < pos + n){
+      close(fd);
+      return buf[off - pos];
+    }
+    pos += n;
+  }
+  close(fd);
+  return 0;
+}
+
+static void
+private_file(void)
+{
+  int fd = open(FILE, O_RDWR);
+  char *p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    fail("mmap private");
+    return;
+  }
+  for(int i = 0; i < FILESZ; i++)
+    if(p[i] != pattern(i)){
+      fail("private mapping has wrong contents");
+      break;
+    }
+  for(int i = FILESZ; i < 3*PGSIZE; i++)
+    if(p[i] != 0){
+      fail("private mapping not zero past end of file");
+      break;
+    }
+  p[0] = 'X';
+  p[PGSIZE] = 'Y';
+  if(munmap(p, 3*PGSIZE) < 0)
+    fail("munmap private");
+  if(fileat(0) != pattern(0) || fileat(PGSIZE) != pattern(PGSIZE))
+    fail("private mapping changed the file");
+}
+
+static void
+shared_file(void)
+{
+  int fd = open(FILE, O_RDWR);
+  char *p = mmap(0, FILESZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    fail("mmap shared");
+    return;
+  }
+  p[1] = 'X';
+  p[PGSIZE + 1] = 'Y';
+  p[FILESZ - 1] = 'Z';
+  if(munmap(p, FILESZ) < 0)
+    fail("munmap shared");
+  if(fileat(1) != 'X' || fileat(PGSIZE + 1) != 'Y' || fileat(FILESZ - 1) != 'Z')
+    fail("shared mapping not written back");
+}
+
+static void
+partial_unmap(void)
+{
+  int fd = open(FILE, O_RDWR);
+  char *p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    fail("mmap for partial unmap");
+    return;
+  }
+  p[2] = 'A';
+  p[PGSIZE + 2] = 'B';
+  p[2*PGSIZE + 2] = 'C';
+  if(munmap(p + PGSIZE, PGSIZE) < 0)
+    fail("munmap middle page");
+  if(fileat(PGSIZE + 2) != 'B')
+    fail("middle page not written back");
+  if(p[2] != 'A' || p[2*PGSIZE + 2] != 'C')
+    fail("pages around unmapped page changed");
+
+  int pid = fork();
+  if(pid == 0){
+    p[PGSIZE] = 1;  // should be killed
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != -1)
+    fail("unmapped page still accessible");
+
+  if(munmap(p, 3*PGSIZE) < 0)
+    fail("munmap rest");
+  if(fileat(2) != 'A' || fileat(2*PGSIZE + 2) != 'C')
+    fail("rest not written back");
+}
+
+static void
+anonymous(int flags)
+{
+  int *p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, flags|MAP_ANONYMOUS, -1, 0);
+  if(p == (int*)-1){
+    fail("mmap anonymous");
+    return;
+  }
+  if(p[0] != 0)
+    fail("anonymous mapping not zero");
+  p[0] = 1;
+  int pid = fork();
+  if(pid == 0){
+    if(p[0] != 1)
+      exit(1);
+    p[0] = 2;
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("child did not see parent's anonymous page");
+  if((flags & MAP_SHARED) && p[0] != 2)
+    fail("MAP_SHARED anonymous page not shared with child");
+  if((flags & MAP_PRIVATE) && p[0] != 1)
+    fail("MAP_PRIVATE anonymous page shared with child");
+  munmap(p, PGSIZE);
+}
+
+static void
+fork_shared_file(void)
+{
+  int fd = open(FILE, O_RDWR);
+  char *p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    fail("mmap for fork");
+    return;
+  }
+  if(p[3] != pattern(3))
+    fail("shared mapping has wrong contents");
+  int pid = fork();
+  if(pid == 0){
+    p[3] = 'C';
+    exit(0);  // writes back at exit
+  }
+  wait(0);
+  if(p[3] != 'C')
+    fail("MAP_SHARED file page not shared with child");
+  if(fileat(3) != 'C')
+    fail("child's shared page not written back at exit");
+  munmap(p, PGSIZE);
+}
+
+// two processes map the same page of the file on their own
+// and store different bytes in it; both must reach the file,
+// whichever unmaps last.
+static void
+two_process(void)
+{
+  int up[2], down[2], xstatus;
+  char c;
+
+  if(pipe(up) < 0 || pipe(down) < 0){
+    fail("pipe");
+    return;
+  }
+  int pid = fork();
+  if(pid == 0){
+    int fd = open(FILE, O_RDWR);
+    char *p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == (char*)-1)
+      exit(1);
+    p[5] = 'P';
+    write(up[1], "x", 1);
+    if(read(down[0], &c, 1) != 1 || p[6] != 'Q')
+      exit(1);
+    exit(0);  // writes back at exit, after the parent
+  }
+  close(up[1]);
+  close(down[0]);
+
+  int fd = open(FILE, O_RDWR);
+  char *p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(p == (char*)-1){
+    fail("mmap for two processes");
+    kill(pid);
+  } else if(read(up[0], &c, 1) != 1){
+    fail("child could not map the file");
+  } else {
+    if(p[5] != 'P')
+      fail("MAP_SHARED page not shared between processes");
+    p[6] = 'Q';
+    if(munmap(p, PGSIZE) < 0)
+      fail("munmap in parent");
+  }
+  write(down[1], "x", 1);
+  close(up[0]);
+  close(down[1]);
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("child did not see parent's store");
+  if(fileat(5) != 'P' || fileat(6) != 'Q')
+    fail("a process's stores to a shared page were lost");
+}
+
+// write() must show through a mapping of the file at once.
+static void
+write_visible(void)
+{
+  int fd = open(FILE, O_RDWR);
+  char *p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    fail("mmap for write");
+    close(fd);
+    return;
+  }
+  if(p[7] != pattern(7))
+    fail("read-only shared mapping has wrong contents");
+  if(write(fd, "0123456789", 10) != 10)
+    fail("write");
+  close(fd);
+  if(p[0] != '0' || p[7] != '7' || p[10] != pattern(10))
+    fail("mapping does not show write()");
+  munmap(p, PGSIZE);
+}
+
+static void
+permissions(void)
+{
+  int fd = open(FILE, O_RDONLY);
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1)
+    fail("writable shared mapping of read-only file");
+  char *p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    fail("writable private mapping of read-only file");
+  else
+    munmap(p, PGSIZE);
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  makefile();
+  private_file();
+  shared_file();
+  partial_unmap();
+  anonymous(MAP_PRIVATE);
+  anonymous(MAP_SHARED);
+  fork_shared_file();
+  two_process();
+  write_visible();
+  permissions();
+  unlink(FILE);
+  if(failed)
+    exit(1);
+  printf("mmaptest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,87 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Pipe creation benchmark for the slab allocator.
+// Reports the memory each pipe costs, then has nproc
+// processes each create, use and close count pipes,
+// and reports the rate at which pipes were created.
+//
+//   pipebench [nproc] [count]
+
+static struct slabinfo*
+findcache(struct memstat *st, char *name)
+{
+  for(int i = 0; i < st->nslab; i++)
+    if(strcmp(st->slab[i].name, name) == 0)
+      return &st->slab[i];
+  return 0;
+}
+
+static void
+churn(int count)
+{
+  int fds[2];
+  char c = 'x';
+
+  for(int i = 0; i < count; i++){
+    if(pipe(fds) < 0){
+      printf("pipebench: pipe failed\n");
+      exit(1);
+    }
+    if(write(fds[1], &c, 1) != 1 || read(fds[0], &c, 1) != 1){
+      printf("pipebench: pipe i/o failed\n");
+      exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st0, st1;
+  struct slabinfo *si;
+  int nproc = 4, count = 5000;
+  int t0, t1;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    count = atoi(argv[2]);
+
+  if(memstat(&st0) < 0 || (si = findcache(&st0, "pipe")) == 0){
+    printf("pipebench: no pipe cache\n");
+    exit(1);
+  }
+  printf("pipe: %d bytes, %d per %d-byte slab, %d bytes of slab per pipe\n",
+         si->objsize, si->perslab, si->slabsize, si->slabsize / si->perslab);
+
+  t0 = uptime();
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("pipebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      churn(count);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < nproc; i++)
+    wait(0);
+  t1 = uptime();
+
+  memstat(&st1);
+  si = findcache(&st1, "pipe");
+  printf("%d pipes by %d processes in %d ticks", nproc * count, nproc, t1 - t0);
+  if(t1 > t0)
+    printf(", %d pipes/tick", nproc * count / (t1 - t0));
+  printf("\n");
+  printf("pipe cache now holds %d slabs, %ld pipes allocated since boot\n",
+         si->nslabs, si->nalloc);
+  exit(0);
+}
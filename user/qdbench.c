@@ -0,0 +1,128 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Disk read throughput against the number of requests in
+// flight. For each depth, that many processes each read a
+// file of their own that is not in the buffer cache, so the
+// disk has up to depth reads (and their read-ahead) queued
+// at once. Reports disk requests per second, and the disk
+// interrupts taken per MB read. A tick is about a tenth of
+// a second.
+//
+//   qdbench
+
+#define FILEKB 128             // each reader's file
+#define NFILL 10               // then this many MAXFILE files, to
+                               // push the others out of the cache
+
+static int depths[] = { 1, 2, 4, 8, 16 };
+static char buf[BSIZE];
+
+static void
+name(char *path, int depth, int i)
+{
+  path[0] = 'q';
+  path[1] = 'd';
+  path[2] = '0' + depth / 10;
+  path[3] = '0' + depth % 10;
+  path[4] = 'a' + i;
+  path[5] = 0;
+}
+
+static void
+mkfile(char *path, int kb)
+{
+  int fd, n;
+
+  if((fd = open(path, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("qdbench: create %s failed\n", path);
+    exit(1);
+  }
+  for(n = 0; n < kb; n += BSIZE / 1024)
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("qdbench: write %s failed\n", path);
+      exit(1);
+    }
+  close(fd);
+}
+
+static void
+reader(char *path)
+{
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    printf("qdbench: open %s failed\n", path);
+    exit(1);
+  }
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  close(fd);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[8];
+  struct memstat st0, st1;
+  int d, depth, i, t0, t, kb, xstatus;
+
+  for(d = 0; d < sizeof(depths)/sizeof(depths[0]); d++)
+    for(i = 0; i < depths[d]; i++){
+      name(path, depths[d], i);
+      mkfile(path, FILEKB);
+    }
+  for(i = 0; i < NFILL; i++){
+    name(path, 0, i);
+    mkfile(path, MAXFILE*BSIZE/1024);
+  }
+
+  printf("readers each reading %d KB from the disk:\n", FILEKB);
+  for(d = 0; d < sizeof(depths)/sizeof(depths[0]); d++){
+    depth = depths[d];
+    memstat(&st0);
+    t0 = uptime();
+    for(i = 0; i < depth; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("qdbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        name(path, depth, i);
+        reader(path);
+      }
+    }
+    for(i = 0; i < depth; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t = uptime() - t0;
+    memstat(&st1);
+
+    kb = depth * FILEKB;
+    printf("  depth %d: %d KB in %d ticks", depth, kb, t);
+    if(t > 0)
+      printf(", %d KB/s", kb * 10 / t);
+    if(t > 0)
+      printf(", %d requests/s", (int)(st1.breq - st0.breq) * 10 / t);
+    printf(", %d interrupts/MB\n", (int)(st1.dintr - st0.dintr) * 1024 / kb);
+  }
+
+  for(d = 0; d < sizeof(depths)/sizeof(depths[0]); d++)
+    for(i = 0; i < depths[d]; i++){
+      name(path, depths[d], i);
+      unlink(path);
+    }
+  for(i = 0; i < NFILL; i++){
+    name(path, 0, i);
+    unlink(path);
+  }
+  exit(0);
+}
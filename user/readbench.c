@@ -0,0 +1,95 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Sequential read throughput from the disk. Reads a set of
+// large files front to back, pass after pass; together they
+// are larger than the buffer cache grows, so each pass reads
+// them from the disk again. Reports the rate for each read
+// size, and how many of the blocks the kernel had already
+// read ahead. A tick is about a tenth of a second.
+//
+//   readbench [passes]
+
+#define NFILE 10               // files, of MAXFILE blocks
+#define FILEBYTES (MAXFILE*BSIZE)
+
+static char buf[8*BSIZE];
+
+static void
+mkfile(char *path)
+{
+  int fd, n;
+
+  if((fd = open(path, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("readbench: create %s failed\n", path);
+    exit(1);
+  }
+  for(n = 0; n < FILEBYTES; n += BSIZE)
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("readbench: write %s failed\n", path);
+      exit(1);
+    }
+  close(fd);
+}
+
+static void
+run(int size, int passes)
+{
+  char path[] = "rb0";
+  struct memstat st0, st1;
+  int p, i, fd, n, t0, t, kb = 0;
+  uint64 miss, ahead;
+
+  memstat(&st0);
+  t0 = uptime();
+  for(p = 0; p < passes; p++){
+    for(i = 0; i < NFILE; i++){
+      path[2] = '0' + i;
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf("readbench: open %s failed\n", path);
+        exit(1);
+      }
+      while((n = read(fd, buf, size)) > 0)
+        kb += n / 512;
+      close(fd);
+    }
+  }
+  t = uptime() - t0;
+  memstat(&st1);
+  kb /= 2;
+
+  miss = st1.bmiss - st0.bmiss;
+  ahead = st1.baheadhit - st0.baheadhit;
+  printf("  %d-byte reads: %d KB in %d ticks", size, kb, t);
+  if(t > 0)
+    printf(", %d KB/s", kb * 10 / t);
+  printf(", %d blocks read ahead, %d missed\n", (int)ahead, (int)miss);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[] = "rb0";
+  int passes = 2, i;
+
+  if(argc > 1)
+    passes = atoi(argv[1]);
+
+  for(i = 0; i < NFILE; i++){
+    path[2] = '0' + i;
+    mkfile(path);
+  }
+  printf("%d passes over %d files of %d KB:\n", passes, NFILE, (int)(FILEBYTES / 1024));
+  run(512, passes);
+  run(BSIZE, passes);
+  run(sizeof(buf), passes);
+  for(i = 0; i < NFILE; i++){
+    path[2] = '0' + i;
+    unlink(path);
+  }
+  exit(0);
+}
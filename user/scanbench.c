@@ -0,0 +1,166 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Does reading large files flush the buffer cache of inode,
+// bitmap and directory blocks? stat()s the files of a
+// directory, which reads its blocks and the files' inodes,
+// round after round with a pause between, first alone and
+// then while a child reads large files over and over, and
+// reports the hit rate for those blocks (from memstat())
+// in each case. The large files together are bigger than
+// the cache can grow. A tick is about a tenth of a second.
+//
+//   scanbench [rounds]
+
+#define NMETA 100              // small files
+#define NSCAN 10               // large files, of MAXFILE blocks
+#define FILEBYTES (MAXFILE*BSIZE)
+
+static char buf[BSIZE];
+
+static void
+name(char *path, char *prefix, int i)
+{
+  int n = strlen(prefix);
+
+  strcpy(path, prefix);
+  path[n] = '0' + i / 100;
+  path[n+1] = '0' + i / 10 % 10;
+  path[n+2] = '0' + i % 10;
+  path[n+3] = 0;
+}
+
+static void
+mkfile(char *path, int n)
+{
+  int fd, k;
+
+  if((fd = open(path, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("scanbench: create %s failed\n", path);
+    exit(1);
+  }
+  for(k = 0; k < n; k += sizeof(buf))
+    if(write(fd, buf, n - k < sizeof(buf) ? n - k : sizeof(buf)) < 0){
+      printf("scanbench: write %s failed\n", path);
+      exit(1);
+    }
+  close(fd);
+}
+
+// read the large files until killed.
+static void
+scan(void)
+{
+  char path[16];
+  int fd, i;
+
+  for(;;){
+    for(i = 0; i < NSCAN; i++){
+      name(path, "scan", i);
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf("scanbench: open %s failed\n", path);
+        exit(1);
+      }
+      while(read(fd, buf, sizeof(buf)) > 0)
+        ;
+      close(fd);
+    }
+  }
+}
+
+static void
+report(char *what, struct memstat *st0, struct memstat *st1)
+{
+  uint64 hit = st1->bmhit - st0->bmhit, miss = st1->bmmiss - st0->bmmiss;
+  uint64 dhit = (st1->bhit - st0->bhit) - hit;
+  uint64 dmiss = (st1->bmiss - st0->bmiss) - miss;
+
+  printf("  %s: metadata %d hits %d misses", what, (int)hit, (int)miss);
+  if(hit + miss > 0)
+    printf(" (%d%%)", (int)(hit * 100 / (hit + miss)));
+  printf(", other %d hits %d misses", (int)dhit, (int)dmiss);
+  if(dhit + dmiss > 0)
+    printf(" (%d%%)", (int)(dhit * 100 / (dhit + dmiss)));
+  printf(", %d evicted, %d ghost hits\n",
+         (int)(st1->bevict - st0->bevict), (int)(st1->bghosthit - st0->bghosthit));
+}
+
+static void
+meta(char *what, int rounds)
+{
+  struct memstat st0, st1;
+  struct stat st;
+  char path[16];
+  int r, i;
+
+  if(memstat(&st0) < 0){
+    printf("scanbench: memstat failed\n");
+    exit(1);
+  }
+  for(r = 0; r < rounds; r++){
+    for(i = 0; i < NMETA; i++){
+      name(path, "sb/f", i);
+      if(stat(path, &st) < 0){
+        printf("scanbench: stat %s failed\n", path);
+        exit(1);
+      }
+    }
+    pause(1);
+  }
+  memstat(&st1);
+  report(what, &st0, &st1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16];
+  int rounds = 20, i, pid;
+  struct memstat st;
+
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+
+  if(mkdir("sb") < 0){
+    printf("scanbench: mkdir sb failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NMETA; i++){
+    name(path, "sb/f", i);
+    mkfile(path, 16);
+  }
+  for(i = 0; i < NSCAN; i++){
+    name(path, "scan", i);
+    mkfile(path, FILEBYTES);
+  }
+
+  printf("%d rounds of stat() on %d files:\n", rounds, NMETA);
+  meta("alone", rounds);
+  if((pid = fork()) < 0){
+    printf("scanbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0)
+    scan();
+  meta("during scan", rounds);
+  kill(pid);
+  wait(0);
+  memstat(&st);
+  printf("  %d buffers, %d on A1in, %d pinned\n",
+         (int)st.nbuf, (int)st.nbufa1, (int)st.bpinned);
+
+  for(i = 0; i < NMETA; i++){
+    name(path, "sb/f", i);
+    unlink(path);
+  }
+  unlink("sb");
+  for(i = 0; i < NSCAN; i++){
+    name(path, "scan", i);
+    unlink(path);
+  }
+  exit(0);
+}
@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
 // Execute cmd.  Never returns.
@@ -131,6 +132,76 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can cmd be run with spawn() alone? It can if it is a
+// command with redirections, or a pipeline of them.
+int
+canspawn(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    return ((struct execcmd*)cmd)->argv[0] != 0;
+  case REDIR:
+    return canspawn(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    return canspawn(pcmd->left) && canspawn(pcmd->right);
+  }
+  return 0;
+}
+
+// Start cmd, which canspawn(), with spawn() rather than by
+// forking the shell; fd[] holds the descriptors to give it as
+// 0, 1 and 2. Returns the number of processes started.
+int
+spawncmd(struct cmd *cmd, int fd[3])
+{
+  int p[2], sfd[3], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(spawn(ecmd->argv[0], ecmd->argv, fd) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    memmove(sfd, fd, sizeof(sfd));
+    if((sfd[rcmd->fd] = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    n = spawncmd(rcmd->cmd, sfd);
+    close(sfd[rcmd->fd]);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    memmove(sfd, fd, sizeof(sfd));
+    sfd[1] = p[1];
+    n = spawncmd(pcmd->left, sfd);
+    sfd[0] = p[0];
+    sfd[1] = fd[1];
+    n += spawncmd(pcmd->right, sfd);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  panic("spawncmd");
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,7 +217,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n;
+  struct cmd *c;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -168,10 +240,19 @@ main(void)
       cmd[strlen(cmd)-1] = 0;  // chop \n
       if(chdir(cmd+3) < 0)
         fprintf(2, "cannot cd %s\n", cmd+3);
-    } else {
-      if(fork1() == 0)
-        runcmd(parsecmd(cmd));
-      wait(0);
+    } else if((c = parsecmd(cmd)) != 0){
+      // Most commands need no copy of the shell to run in,
+      // so start them directly; the rest get a forked shell.
+      if(canspawn(c)){
+        int sfd[3] = { 0, 1, 2 };
+        for(n = spawncmd(c, sfd); n > 0; n--)
+          wait(0);
+      } else {
+        if(fork1() == 0)
+          runcmd(c);
+        wait(0);
+      }
+      freecmd(c);
     }
   }
   exit(0);
@@ -262,6 +343,31 @@ backcmd(struct cmd *subcmd)
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
 }
+
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
 //PAGEBREAK!
 // Parsing
 
@@ -325,6 +431,15 @@ peek(char **ps, char *es, char *toks)
   return *s && strchr(toks, *s);
 }
 
+// The parser runs in the shell itself, so a syntax error
+// must not exit: it is reported, and the parse returns 0.
+struct cmd*
+syntax(char *msg)
+{
+  fprintf(2, "%s\n", msg);
+  return 0;
+}
+
 struct cmd *parseline(char**, char*);
 struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
@@ -337,11 +452,13 @@ parsecmd(char *s)
   struct cmd *cmd;
 
   es = s + strlen(s);
-  cmd = parseline(&s, es);
+  if((cmd = parseline(&s, es)) == 0)
+    return 0;
   peek(&s, es, "");
   if(s != es){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    freecmd(cmd);
+    return syntax("syntax");
   }
   nulterminate(cmd);
   return cmd;
@@ -350,16 +467,21 @@ parsecmd(char *s)
 struct cmd*
 parseline(char **ps, char *es)
 {
-  struct cmd *cmd;
+  struct cmd *cmd, *right;
 
-  cmd = parsepipe(ps, es);
+  if((cmd = parsepipe(ps, es)) == 0)
+    return 0;
   while(peek(ps, es, "&")){
     gettoken(ps, es, 0, 0);
     cmd = backcmd(cmd);
   }
   if(peek(ps, es, ";")){
     gettoken(ps, es, 0, 0);
-    cmd = listcmd(cmd, parseline(ps, es));
+    if((right = parseline(ps, es)) == 0){
+      freecmd(cmd);
+      return 0;
+    }
+    cmd = listcmd(cmd, right);
   }
   return cmd;
 }
@@ -367,12 +489,17 @@ parseline(char **ps, char *es)
 struct cmd*
 parsepipe(char **ps, char *es)
 {
-  struct cmd *cmd;
+  struct cmd *cmd, *right;
 
-  cmd = parseexec(ps, es);
+  if((cmd = parseexec(ps, es)) == 0)
+    return 0;
   if(peek(ps, es, "|")){
     gettoken(ps, es, 0, 0);
-    cmd = pipecmd(cmd, parsepipe(ps, es));
+    if((right = parsepipe(ps, es)) == 0){
+      freecmd(cmd);
+      return 0;
+    }
+    cmd = pipecmd(cmd, right);
   }
   return cmd;
 }
@@ -385,8 +512,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      freecmd(cmd);
+      return syntax("missing file for redirection");
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -410,9 +539,12 @@ parseblock(char **ps, char *es)
   if(!peek(ps, es, "("))
     panic("parseblock");
   gettoken(ps, es, 0, 0);
-  cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if((cmd = parseline(ps, es)) == 0)
+    return 0;
+  if(!peek(ps, es, ")")){
+    freecmd(cmd);
+    return syntax("syntax - missing )");
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -433,18 +565,24 @@ parseexec(char **ps, char *es)
   cmd = (struct execcmd*)ret;
 
   argc = 0;
-  ret = parseredirs(ret, ps, es);
+  if((ret = parseredirs(ret, ps, es)) == 0)
+    return 0;
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      freecmd(ret);
+      return syntax("syntax");
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
-    ret = parseredirs(ret, ps, es);
+    if(argc >= MAXARGS){
+      freecmd(ret);
+      return syntax("too many args");
+    }
+    if((ret = parseredirs(ret, ps, es)) == 0)
+      return 0;
   }
   cmd->argv[argc] = 0;
   cmd->eargv[argc] = 0;
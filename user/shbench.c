@@ -0,0 +1,151 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Command start-up cost. Runs "echo hi" count times with
+// fork() and exec(), then with spawn(), and then has sh run
+// a script of count such lines. A tick is about a tenth of
+// a second, so commands per second is ten times commands
+// per tick.
+//
+//   shbench [count]
+
+#define SCRIPT "shbench.sh"
+#define OUT "shbench.out"
+
+static char *echo[] = { "echo", "hi", 0 };
+
+static int
+outfile(void)
+{
+  int fd;
+
+  if((fd = open(OUT, O_WRONLY|O_CREATE|O_TRUNC)) < 0){
+    printf("shbench: cannot create %s\n", OUT);
+    exit(1);
+  }
+  return fd;
+}
+
+// check that each of the count commands wrote "hi\n".
+static void
+check(char *what, int count)
+{
+  struct stat st;
+
+  if(stat(OUT, &st) < 0 || st.size != 3*count){
+    printf("shbench: %s: wrong output\n", what);
+    exit(1);
+  }
+}
+
+static void
+report(char *what, int count, int t)
+{
+  printf("  %s: %d commands in %d ticks", what, count, t);
+  if(t > 0)
+    printf(", %d per second", count * 10 / t);
+  printf("\n");
+}
+
+static void
+viafork(int count)
+{
+  int fd = outfile(), t0;
+
+  t0 = uptime();
+  for(int i = 0; i < count; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("shbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(1);
+      dup(fd);
+      close(fd);
+      exec(echo[0], echo);
+      exit(1);
+    }
+    wait(0);
+  }
+  report("fork+exec", count, uptime() - t0);
+  close(fd);
+  check("fork+exec", count);
+}
+
+static void
+viaspawn(int count)
+{
+  int fd = outfile(), t0;
+  int fds[3] = { 0, fd, 2 };
+
+  t0 = uptime();
+  for(int i = 0; i < count; i++){
+    if(spawn(echo[0], echo, fds) < 0){
+      printf("shbench: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+  }
+  report("spawn", count, uptime() - t0);
+  close(fd);
+  check("spawn", count);
+}
+
+static void
+viash(int count)
+{
+  static char *argv[] = { "sh", 0 };
+  int fds[3], t0;
+
+  if((fds[0] = open(SCRIPT, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("shbench: cannot create %s\n", SCRIPT);
+    exit(1);
+  }
+  for(int i = 0; i < count; i++)
+    if(write(fds[0], "echo hi\n", 8) != 8){
+      printf("shbench: write failed\n");
+      exit(1);
+    }
+  close(fds[0]);
+
+  fds[0] = open(SCRIPT, O_RDONLY);
+  fds[1] = outfile();
+  fds[2] = fds[1];  // the prompts
+  t0 = uptime();
+  if(spawn(argv[0], argv, fds) < 0){
+    printf("shbench: cannot run sh\n");
+    exit(1);
+  }
+  wait(0);
+  t0 = uptime() - t0;
+  close(fds[0]);
+  close(fds[1]);
+  unlink(SCRIPT);
+
+  // sh writes "$ " to fd 2 before each line and at the end.
+  struct stat st;
+  if(stat(OUT, &st) < 0 || st.size != 5*count + 2){
+    printf("shbench: sh: wrong output\n");
+    exit(1);
+  }
+  report("sh script", count, t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int count = 1000;
+
+  if(argc > 1)
+    count = atoi(argv[1]);
+
+  printf("starting %d commands:\n", count);
+  viafork(count);
+  viaspawn(count);
+  viash(count);
+  unlink(OUT);
+  exit(0);
+}
@@ -0,0 +1,152 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// Moves 64 MB from one process to another, first through a
+// pipe and then through a ring of pages in a shared memory
+// segment, and reports how long each took. The receiver
+// checks a sum of everything it got.
+//
+//   shmbench [megabytes]
+
+#define CHUNK PGSIZE
+#define NSLOT 16
+
+struct ring {
+  volatile uint64 head;   // chunks written by the sender
+  volatile uint64 tail;   // chunks consumed by the receiver
+};
+
+static uint64 nchunk;
+
+static void
+fill(uint64 *buf, uint64 i)
+{
+  for(int j = 0; j < CHUNK/8; j++)
+    buf[j] = i + j;
+}
+
+static uint64
+sum(uint64 *buf)
+{
+  uint64 s = 0;
+  for(int j = 0; j < CHUNK/8; j++)
+    s += buf[j];
+  return s;
+}
+
+static uint64
+expected(void)
+{
+  uint64 s = 0;
+  for(uint64 i = 0; i < nchunk; i++)
+    s += i * (CHUNK/8) + (CHUNK/8) * (CHUNK/8 - 1) / 2;
+  return s;
+}
+
+static int
+viapipe(void)
+{
+  static uint64 buf[CHUNK/8];
+  int fds[2], t0;
+
+  if(pipe(fds) < 0){
+    printf("shmbench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    uint64 s = 0;
+    close(fds[1]);
+    for(uint64 i = 0; i < nchunk; i++){
+      for(int n = 0; n < CHUNK; ){
+        int r = read(fds[0], (char*)buf + n, CHUNK - n);
+        if(r <= 0)
+          exit(1);
+        n += r;
+      }
+      s += sum(buf);
+    }
+    exit(s == expected() ? 0 : 1);
+  }
+  close(fds[0]);
+  for(uint64 i = 0; i < nchunk; i++){
+    fill(buf, i);
+    if(write(fds[1], buf, CHUNK) != CHUNK){
+      printf("shmbench: pipe write failed\n");
+      exit(1);
+    }
+  }
+  close(fds[1]);
+
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("shmbench: data through pipe was wrong\n");
+    exit(1);
+  }
+  return uptime() - t0;
+}
+
+static int
+viashm(void)
+{
+  struct ring *r;
+  char *slots;
+  int fd, t0;
+
+  if((fd = shmcreate((NSLOT+1) * CHUNK)) < 0 || (r = shmat(fd)) == (void*)-1){
+    printf("shmbench: cannot make segment\n");
+    exit(1);
+  }
+  slots = (char*)r + CHUNK;
+
+  t0 = uptime();
+  if(fork() == 0){
+    uint64 s = 0;
+    for(uint64 i = 0; i < nchunk; i++){
+      while(r->head == i)
+        ;
+      __sync_synchronize();
+      s += sum((uint64*)(slots + (i % NSLOT) * CHUNK));
+      __sync_synchronize();
+      r->tail = i + 1;
+    }
+    exit(s == expected() ? 0 : 1);
+  }
+  for(uint64 i = 0; i < nchunk; i++){
+    while(i - r->tail == NSLOT)
+      ;
+    __sync_synchronize();
+    fill((uint64*)(slots + (i % NSLOT) * CHUNK), i);
+    __sync_synchronize();
+    r->head = i + 1;
+  }
+
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("shmbench: data through shm was wrong\n");
+    exit(1);
+  }
+  t0 = uptime() - t0;
+  shmdt(r);
+  close(fd);
+  return t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 64;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  nchunk = (uint64)mb * 1024 * 1024 / CHUNK;
+
+  printf("moving %d MB between two processes\n", mb);
+  printf("  pipe: %d ticks\n", viapipe());
+  printf("  shm:  %d ticks\n", viashm());
+  exit(0);
+}
@@ -0,0 +1,108 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Scan a working set larger than memory, paging to the swap
+// disk. A child writes every page of an sbrk() region of the
+// given size, then reads and checks it all several times. The
+// pages hold random words, so do not compress; compression is
+// turned off for the run so they all go to the disk. A tick is
+// about a tenth of a second.
+//
+//   swapbench [megabytes [passes]]
+
+static struct memstat st;
+
+static uint64
+word(uint64 i, int j)
+{
+  uint64 x = (i << 9 | j) * 0x9e3779b97f4a7c15ULL;
+
+  return x ^ (x >> 29);
+}
+
+static void
+report(char *what, int mb, int t)
+{
+  printf("  %s: %d MB in %d ticks", what, mb, t);
+  if(t > 0)
+    printf(", %d KB/s", mb * 1024 * 10 / t);
+  printf("\n");
+}
+
+static void
+scan(int mb, int passes)
+{
+  uint64 npages = (uint64)mb * 256, i;
+  uint64 *p;
+  char *brk;
+  int t0, j;
+
+  if((brk = sbrklazy(mb * 1024 * 1024)) == SBRK_ERROR){
+    printf("swapbench: sbrk failed\n");
+    exit(1);
+  }
+  p = (uint64*)(((uint64)brk + 4095) & ~4095ULL);
+  npages--;
+
+  t0 = uptime();
+  for(i = 0; i < npages; i++)
+    for(j = 0; j < 512; j++)
+      p[i*512 + j] = word(i, j);
+  report("write", mb, uptime() - t0);
+
+  for(int pass = 0; pass < passes; pass++){
+    t0 = uptime();
+    for(i = 0; i < npages; i++)
+      for(j = 0; j < 512; j++)
+        if(p[i*512 + j] != word(i, j)){
+          printf("swapbench: page %d came back wrong\n", (int)i);
+          exit(2);
+        }
+    report("read", mb, uptime() - t0);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = 256, passes = 2, old, pid, xstatus;
+
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(argc > 2)
+    passes = atoi(argv[2]);
+
+  if(memstat(&st) < 0){
+    printf("swapbench: memstat failed\n");
+    exit(1);
+  }
+  if(st.nswapslots == 0){
+    printf("swapbench: no swap disk\n");
+    exit(0);
+  }
+  printf("scanning %d MB with %d MB free and %d MB of swap:\n",
+         mb, (int)(st.nfree / 256), (int)(st.nswapslots / 256));
+
+  old = zswapctl(ZSWAP_DISK);
+  if((pid = fork()) < 0){
+    printf("swapbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    scan(mb, passes);
+    exit(0);
+  }
+  wait(&xstatus);
+  zswapctl(old);
+
+  memstat(&st);
+  printf("swap: %d pages on disk, %d out, %d in\n",
+         (int)st.nswap, (int)st.swout, (int)st.swin);
+  if(xstatus != 0){
+    printf("swapbench: failed\n");
+    exit(1);
+  }
+  exit(0);
+}
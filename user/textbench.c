@@ -0,0 +1,93 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// Shared text benchmark. Starts n instances of this program,
+// each of which touches its text and then waits, and reports
+// how long they took to start and how much memory they use
+// between them. With the page cache, every instance after the
+// first maps the text pages the first one read in.
+//
+//   textbench [n]
+
+// some text for the workers to touch.
+static int
+work(int x)
+{
+  for(int i = 0; i < 1000; i++)
+    x = x * 1103515245 + 12345 + (x >> 7);
+  return x;
+}
+
+static void
+worker(int up, int go)
+{
+  char c = work(getpid());
+
+  write(up, &c, 1);
+  read(go, &c, 1);  // until the parent closes its end
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st0, st1;
+  int up[2], go[2];
+  char upfd[8], gofd[8];
+  int n = 30, t0, t1;
+  char c;
+
+  if(argc == 4 && strcmp(argv[1], "-w") == 0)
+    worker(atoi(argv[2]), atoi(argv[3]));
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  if(pipe(up) < 0 || pipe(go) < 0){
+    printf("textbench: pipe failed\n");
+    exit(1);
+  }
+  // fd numbers are small, so one digit each.
+  upfd[0] = '0' + up[1]; upfd[1] = 0;
+  gofd[0] = '0' + go[0]; gofd[1] = 0;
+
+  memstat(&st0);
+  t0 = uptime();
+  for(int i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("textbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      char *wargv[] = { "textbench", "-w", upfd, gofd, 0 };
+      close(up[0]);
+      close(go[1]);
+      exec("textbench", wargv);
+      printf("textbench: exec failed\n");
+      exit(1);
+    }
+  }
+  close(up[1]);
+  close(go[0]);
+  for(int i = 0; i < n; i++){
+    if(read(up[0], &c, 1) != 1){
+      printf("textbench: worker died\n");
+      exit(1);
+    }
+  }
+  t1 = uptime();
+  memstat(&st1);
+
+  close(go[1]);
+  for(int i = 0; i < n; i++)
+    wait(0);
+
+  printf("%d instances started in %d ticks\n", n, t1 - t0);
+  printf("resident: %ld pages for %d instances, %ld per instance\n",
+         st0.nfree - st1.nfree, n, (st0.nfree - st1.nfree) / n);
+  printf("page cache: %ld pages, %ld hits, %ld misses\n",
+         st1.npcache, st1.pchit - st0.pchit, st1.pcmiss - st0.pcmiss);
+  exit(0);
+}
@@ -0,0 +1,110 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// Threads and mutexes, on top of clone() and futexes.
+//
+// A thread is a child process that shares the caller's memory
+// and open files; it runs on a stack from malloc() and exits
+// when its function returns. thread_create() and thread_join()
+// use malloc() and free(), which are not thread-safe, so call
+// them from one thread only.
+
+#define TSTACK (4*PGSIZE)  // bytes of stack per thread
+#define NTHREAD 16         // threads alive at once
+
+static struct thread {
+  int pid;                 // 0 if the slot is free
+  char *stack;
+  void (*fn)(void*);
+  void *arg;
+} threads[NTHREAD];
+
+static void
+start(void *arg)
+{
+  struct thread *t = arg;
+
+  t->fn(t->arg);
+  exit(0);
+}
+
+// Start a thread running fn(arg). Returns its id, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct thread *t;
+  int pid;
+
+  for(t = threads; t < &threads[NTHREAD]; t++)
+    if(t->pid == 0)
+      break;
+  if(t == &threads[NTHREAD])
+    return -1;
+  if((t->stack = malloc(TSTACK)) == 0)
+    return -1;
+  t->fn = fn;
+  t->arg = arg;
+  pid = clone(start, t, (void*)(((uint64)t->stack + TSTACK) & ~15L));
+  if(pid < 0){
+    free(t->stack);
+    return -1;
+  }
+  t->pid = pid;
+  return pid;
+}
+
+// Wait for thread tid to exit, and free its stack.
+// Other threads (and child processes) that exit
+// meanwhile are reaped too. Returns 0, or -1 if
+// there is no such thread.
+int
+thread_join(int tid)
+{
+  struct thread *t;
+  int pid;
+
+  for(;;){
+    for(t = threads; t < &threads[NTHREAD]; t++)
+      if(t->pid == tid)
+        break;
+    if(t == &threads[NTHREAD])
+      return -1;
+    if((pid = wait(0)) < 0)
+      return -1;
+    for(t = threads; t < &threads[NTHREAD]; t++){
+      if(t->pid == pid){
+        free(t->stack);
+        t->pid = 0;
+      }
+    }
+    if(pid == tid)
+      return 0;
+  }
+}
+
+// A mutex's state is 0 when unlocked, 1 when locked, and 2 when
+// locked with threads perhaps sleeping in futexwait(); only then
+// does mutex_unlock() need to enter the kernel.
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c = 0;
+
+  if(__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futexwait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+    futexwake(&m->state, 1);
+}
@@ -0,0 +1,105 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Sums an array with 1, 2, ... threads and reports how long
+// each took; run with CPUS=n and the time should drop until
+// there are n threads. The threads add their partial sums up
+// under a mutex; a last round has them all bump one counter
+// under the mutex, and checks that no increment was lost.
+//
+//   threadbench [maxthreads] [rounds]
+
+#define N (1024*1024)  // array elements
+#define NBUMP 10000    // counter increments per thread
+
+static uint a[N];
+static struct mutex mu;
+static uint64 total;
+static int nthread, rounds;
+static int counter;
+
+static void
+summer(void *arg)
+{
+  int i = (int)(uint64)arg;
+  int lo = (uint64)N * i / nthread, hi = (uint64)N * (i+1) / nthread;
+  uint64 s = 0;
+
+  for(int r = 0; r < rounds; r++)
+    for(int j = lo; j < hi; j++)
+      s += a[j];
+  mutex_lock(&mu);
+  total += s;
+  mutex_unlock(&mu);
+}
+
+static void
+bumper(void *arg)
+{
+  for(int i = 0; i < NBUMP; i++){
+    mutex_lock(&mu);
+    counter++;
+    mutex_unlock(&mu);
+  }
+}
+
+// run fn in n threads and wait for them all.
+static void
+run(void (*fn)(void*), int n)
+{
+  int tids[16];
+
+  nthread = n;
+  for(int i = 0; i < n; i++){
+    if((tids[i] = thread_create(fn, (void*)(uint64)i)) < 0){
+      printf("threadbench: thread_create failed\n");
+      exit(1);
+    }
+  }
+  for(int i = 0; i < n; i++)
+    thread_join(tids[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxthread = 4, t0;
+
+  rounds = 20;
+  if(argc > 1)
+    maxthread = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(maxthread < 1 || maxthread > 16){
+    printf("threadbench: 1 to 16 threads\n");
+    exit(1);
+  }
+
+  for(int j = 0; j < N; j++)
+    a[j] = j;
+
+  printf("summing %d ints %d times:\n", N, rounds);
+  for(int n = 1; n <= maxthread; n++){
+    total = 0;
+    t0 = uptime();
+    run(summer, n);
+    t0 = uptime() - t0;
+    if(total != (uint64)rounds * N * (N - 1) / 2){
+      printf("threadbench: wrong sum with %d threads\n", n);
+      exit(1);
+    }
+    printf("  %d threads: %d ticks\n", n, t0);
+  }
+
+  t0 = uptime();
+  run(bumper, maxthread);
+  t0 = uptime() - t0;
+  if(counter != maxthread * NBUMP){
+    printf("threadbench: counter is %d, not %d\n", counter, maxthread * NBUMP);
+    exit(1);
+  }
+  printf("%d threads x %d mutex-protected increments: %d ticks\n",
+         maxthread, NBUMP, t0);
+  exit(0);
+}
@@ -46,14 +46,24 @@ strlen(const char *s)
   return n;
 }
 
+// memset(), memmove() and memcmp() work a word at a time
+// where they can, as the kernel's do (kernel/string.c). They
+// do not use the vector unit, whose registers the kernel does
+// not save for user programs.
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+  char *d = (char *) dst;
+  uint64 w;
+
+  w = (uchar)c * 0x0101010101010101ULL;
+  for(; n > 0 && ((uint64)d & 7); n--)
+    *d++ = c;
+  for(; n >= 8; n -= 8, d += 8)
+    *(uint64*)d = w;
+  for(; n > 0; n--)
+    *d++ = c;
   return dst;
 }
 
@@ -114,15 +124,31 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  int words;
 
   dst = vdst;
   src = vsrc;
+  words = (((uint64)src ^ (uint64)dst) & 7) == 0;
   if (src > dst) {
+    if(words){
+      for(; n > 0 && ((uint64)dst & 7); n--)
+        *dst++ = *src++;
+      for(; n >= 8; n -= 8, dst += 8, src += 8)
+        *(uint64*)dst = *(const uint64*)src;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(words){
+      for(; n > 0 && ((uint64)dst & 7); n--)
+        *--dst = *--src;
+      for(; n >= 8; n -= 8){
+        dst -= 8, src -= 8;
+        *(uint64*)dst = *(const uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -133,6 +159,15 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+
+  // skip equal words, then find the byte that differs.
+  if((((uint64)p1 ^ (uint64)p2) & 7) == 0){
+    for(; n > 0 && ((uint64)p1 & 7) && *p1 == *p2; n--)
+      p1++, p2++;
+    if(((uint64)p1 & 7) == 0)
+      for(; n >= 8 && *(uint64*)p1 == *(uint64*)p2; n -= 8)
+        p1 += 8, p2 += 8;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
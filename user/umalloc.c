@@ -3,88 +3,234 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// Small requests are rounded up to a multiple of 16 bytes and
+// served from a free list per size, so malloc() and free() of
+// them take constant time. The lists are filled by carving up
+// runs of RUN units taken from the large blocks; small blocks
+// are not coalesced.
+//
+// Large requests come from free lists binned by the log2 of
+// their size, first fit within a bin. Each block's header
+// records its own size and that of the block just below, so
+// free() merges a large block with free neighbours on either
+// side without a search.
+//
+// The heap grows with lazy sbrk() calls of at least HEAPGROW
+// bytes; pages are allocated when they are first touched.
 
-typedef long Align;
+#define SMALL    32          // largest small block, in units
+#define RUN      256         // units carved at a time into small blocks
+#define HEAPGROW (64*1024)   // least the heap grows by, in bytes
+#define NBIN     32          // large free lists
+#define LARGE    0           // class of a block that is not small
+
+typedef union header Header;
 
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    uint size;      // in units of sizeof(Header), with this header
+    uint prevsize;  // size of the large block just below, or 0
+    uint class;     // size of a small block, or LARGE
+    uint free;      // on a large free list?
   } s;
-  Align x;
+  uint64 align[2];
 };
 
-typedef union header Header;
+// A free block: the header, then the list links.
+struct freeblk {
+  Header h;
+  struct freeblk *next;
+  struct freeblk *prev;   // large lists only
+};
 
-static Header base;
-static Header *freep;
+static struct freeblk *small[SMALL+1];  // free small blocks, by size
+static struct freeblk *bins[NBIN];      // free large blocks, by log2 size
+static Header *top;                     // marks the end of the heap
 
-void
-free(void *ap)
+static int
+bin(uint64 nunits)
 {
-  Header *bp, *p;
+  int b = 0;
 
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  while(nunits >>= 1)
+    b++;
+  return b < NBIN ? b : NBIN-1;
 }
 
-static Header*
-morecore(uint nu)
+static void
+binremove(struct freeblk *f)
+{
+  if(f->prev)
+    f->prev->next = f->next;
+  else
+    bins[bin(f->h.s.size)] = f->next;
+  if(f->next)
+    f->next->prev = f->prev;
+  f->h.s.free = 0;
+}
+
+static void
+bininsert(struct freeblk *f)
+{
+  int b = bin(f->h.s.size);
+
+  f->h.s.free = 1;
+  f->prev = 0;
+  f->next = bins[b];
+  if(f->next)
+    f->next->prev = f;
+  bins[b] = f;
+}
+
+// Put large block h on a free list, merged with the blocks
+// above and below it if they are free.
+static void
+freelarge(Header *h)
+{
+  Header *next, *prev;
+
+  next = h + h->s.size;
+  if(next->s.free){
+    binremove((struct freeblk*)next);
+    h->s.size += next->s.size;
+  }
+  if(h->s.prevsize && (prev = h - h->s.prevsize)->s.free){
+    binremove((struct freeblk*)prev);
+    prev->s.size += h->s.size;
+    h = prev;
+  }
+  (h + h->s.size)->s.prevsize = h->s.size;
+  bininsert((struct freeblk*)h);
+}
+
+// Grow the heap by at least nunits. The last unit of the
+// heap is a header that is never free, so that freelarge()
+// need not check for the end.
+static int
+morecore(uint64 nunits)
 {
   char *p;
-  Header *hp;
+  uint64 n;
+  Header *h;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == SBRK_ERROR)
-    return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  n = (nunits + 2) * sizeof(Header);
+  if(n < HEAPGROW)
+    n = HEAPGROW;
+  if(n > 0x7fffffff || (p = sbrklazy(n)) == SBRK_ERROR)
+    return -1;
+  if(top && p == (char*)(top + 1)){
+    // The old end marker becomes the new block's header.
+    h = top;
+    n += sizeof(Header);
+  } else {
+    // Someone else moved the break; start a separate piece.
+    h = (Header*)(p + (-(uint64)p % sizeof(Header)));
+    n -= (char*)h - p;
+    h->s.prevsize = 0;
+  }
+  h->s.size = n / sizeof(Header) - 1;
+  h->s.class = LARGE;
+  h->s.free = 0;
+  top = h + h->s.size;
+  top->s.size = 1;
+  top->s.class = LARGE;
+  top->s.free = 0;
+  freelarge(h);
+  return 0;
+}
+
+// Take a large block of at least nunits off the free lists,
+// splitting off what it doesn't need.
+static Header*
+takelarge(uint64 nunits)
+{
+  struct freeblk *f;
+  Header *h, *rest;
+  int b;
+
+  for(;;){
+    b = bin(nunits);
+    for(f = bins[b]; f && f->h.s.size < nunits; f = f->next)
+      ;
+    // Anything in a higher bin is big enough.
+    for(b++; f == 0 && b < NBIN; b++)
+      f = bins[b];
+    if(f)
+      break;
+    if(morecore(nunits) < 0)
+      return 0;
+  }
+
+  binremove(f);
+  h = &f->h;
+  if(h->s.size - nunits >= sizeof(struct freeblk)/sizeof(Header)){
+    rest = h + nunits;
+    rest->s.size = h->s.size - nunits;
+    rest->s.prevsize = nunits;
+    rest->s.class = LARGE;
+    h->s.size = nunits;
+    (rest + rest->s.size)->s.prevsize = rest->s.size;
+    bininsert((struct freeblk*)rest);
+  }
+  return h;
+}
+
+// Fill the free list of small blocks of nunits.
+static int
+refill(uint nunits)
+{
+  Header *run, *h;
+  struct freeblk *f;
+
+  if((run = takelarge(RUN)) == 0)
+    return -1;
+  for(h = run + 1; h + nunits <= run + run->s.size; h += nunits){
+    h->s.size = nunits;
+    h->s.class = nunits;
+    f = (struct freeblk*)h;
+    f->next = small[nunits];
+    small[nunits] = f;
+  }
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  Header *h;
+  struct freeblk *f;
+
+  if(ap == 0)
+    return;
+  h = (Header*)ap - 1;
+  if(h->s.class != LARGE){
+    f = (struct freeblk*)h;
+    f->next = small[h->s.class];
+    small[h->s.class] = f;
+  } else
+    freelarge(h);
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  uint64 nunits;
+  struct freeblk *f;
+  Header *h;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  nunits = ((uint64)nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits < sizeof(struct freeblk)/sizeof(Header))
+    nunits = sizeof(struct freeblk)/sizeof(Header);
+  if(nunits <= SMALL){
+    if(small[nunits] == 0 && refill(nunits) < 0)
+      return 0;
+    f = small[nunits];
+    small[nunits] = f->next;
+    return (void*)(&f->h + 1);
   }
+  if((h = takelarge(nunits)) == 0)
+    return 0;
+  return (void*)(h + 1);
 }
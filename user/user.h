@@ -32,6 +32,22 @@ int getpinfo(struct pstat*);   // Process bilgilerini al
 // SYSTEM CALL TRACING: New system call
 int getsyscallcount(int);      // Get count of specific syscall
 
+struct memstat;
+int memstat(struct memstat*);  // physical memory allocator statistics
+int buddytest(int, int);       // drive the buddy allocator, see memstat.h
+void *mmap(void *addr, uint64 len, int prot, int flags, int fd, int off);
+int munmap(void *addr, uint64 len);
+int shmcreate(uint64 size);     // returns a descriptor for a new segment
+void *shmat(int fd);
+int shmdt(void *addr);
+int asidctl(int on);
+int clone(void (*fn)(void*), void *arg, void *stack);
+int futexwait(int *addr, int val);
+int futexwake(int *addr, int n);
+int spawn(const char*, char**, int*);
+int zswapctl(int on);
+int diskpoll(int mode);
+
 // ulib.c
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
@@ -54,3 +70,12 @@ void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
 // umalloc.c
 void* malloc(uint);
 void free(void*);
+
+// thread.c
+struct mutex {
+  int state;
+};
+int thread_create(void (*fn)(void*), void *arg);
+int thread_join(int tid);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
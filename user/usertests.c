@@ -2403,7 +2403,8 @@ void argptest(char *s)
 }
 
 // check that there's an invalid page beneath
-// the user stack, to catch stack overflow.
+// the space the user stack may grow into, to
+// catch stack overflow.
 void
 stacktest(char *s)
 {
@@ -2413,7 +2414,7 @@ stacktest(char *s)
   pid = fork();
   if(pid == 0) {
     char *sp = (char *) r_sp();
-    sp -= USERSTACK*PGSIZE;
+    sp = (char *) PGROUNDUP((uint64) sp) - USERSTACKMAX*PGSIZE - 1;
     // the *sp should cause a trap.
     printf("%s: stacktest: read below stack %d\n", s, *sp);
     exit(1);
@@ -2428,6 +2429,60 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// use about 1 KB of stack per call, n calls deep, and check
+// that each call's frame is intact on the way back up.
+static int
+deeprecurse(int n)
+{
+  volatile char buf[1000];
+
+  buf[0] = n;
+  buf[sizeof(buf)-1] = n;
+  if(n > 0 && deeprecurse(n - 1) < 0)
+    return -1;
+  if(buf[0] != (char)n || buf[sizeof(buf)-1] != (char)n)
+    return -1;
+  return 0;
+}
+
+// check that the user stack grows to 1 MB as the
+// program recurses, and no further than USERSTACKMAX
+// pages.
+void
+stackgrow(char *s)
+{
+  int pid;
+  int xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(deeprecurse(1024) < 0);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: 1 MB of stack failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    deeprecurse(USERSTACKMAX*PGSIZE/1000 + 1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: stack grew past USERSTACKMAX\n", s);
+    exit(1);
+  }
+}
+
 // check that writes to a few forbidden addresses
 // cause a fault, e.g. process's text and TRAMPOLINE.
 void
@@ -2806,6 +2861,7 @@ struct test {
   {bigargtest, "bigargtest"},
   {argptest, "argptest"},
   {stacktest, "stacktest"},
+  {stackgrow, "stackgrow"},
   {nowrite, "nowrite"},
   {pgbug, "pgbug" },
   {sbrkbugs, "sbrkbugs" },
@@ -45,3 +45,17 @@ entry("uptime");
 entry("settickets");  # LOTTERY SCHEDULER
 entry("getpinfo");    # LOTTERY SCHEDULER
 entry("getsyscallcount");  # SYSTEM CALL TRACING
+entry("memstat");
+entry("buddytest");
+entry("mmap");
+entry("munmap");
+entry("shmcreate");
+entry("shmat");
+entry("shmdt");
+entry("asidctl");
+entry("clone");
+entry("futexwait");
+entry("futexwake");
+entry("spawn");
+entry("zswapctl");
+entry("diskpoll");
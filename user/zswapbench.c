@@ -0,0 +1,126 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+// How large a working set fits with and without compressed
+// swap. A child touches every page of ever larger sbrk()
+// regions, in steps of a quarter of the memory free at the
+// start, and then checks them all; it is killed when the
+// kernel runs out of memory. Each page holds 1 KB of random
+// bytes and 3 KB of a repeating pattern, so compresses to
+// a bit over a quarter of its size.
+//
+//   zswapbench [maxsteps]
+
+static struct memstat st;
+
+static uint64
+freepages(void)
+{
+  if(memstat(&st) < 0){
+    printf("zswapbench: memstat failed\n");
+    exit(1);
+  }
+  return st.nfree;
+}
+
+static void
+fill(uint64 *w, uint64 i)
+{
+  uint64 x = i * 0x9e3779b97f4a7c15ULL + 1;
+  int j;
+
+  for(j = 0; j < 1024/8; j++){
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    w[j] = x;
+  }
+  for(; j < 4096/8; j++)
+    w[j] = i;
+}
+
+static int
+check(uint64 *w, uint64 i)
+{
+  static uint64 want[4096/8];
+
+  fill(want, i);
+  for(int j = 0; j < 4096/8; j++)
+    if(w[j] != want[j])
+      return 0;
+  return 1;
+}
+
+// Touch and then check npages pages in a child.
+// Returns 1 if it finished, 0 if it was killed.
+static int
+run(uint64 npages)
+{
+  char *p;
+  int pid, xstatus;
+
+  if((pid = fork()) < 0){
+    printf("zswapbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if((p = sbrklazy(npages * 4096)) == SBRK_ERROR)
+      exit(1);
+    p = (char*)(((uint64)p + 4095) & ~4095ULL);
+    for(uint64 i = 0; i + 1 < npages; i++)
+      fill((uint64*)(p + i*4096), i);
+    for(uint64 i = 0; i + 1 < npages; i++)
+      if(!check((uint64*)(p + i*4096), i))
+        exit(2);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus == 2){
+    printf("zswapbench: a page came back wrong\n");
+    exit(1);
+  }
+  return xstatus == 0;
+}
+
+// Return the largest working set, in pages, that completes.
+static uint64
+largest(char *what, uint64 step, int maxsteps)
+{
+  uint64 best = 0;
+  int t0 = uptime();
+
+  for(int k = 1; k <= maxsteps; k++){
+    if(!run(k * step))
+      break;
+    best = k * step;
+  }
+  printf("  %s: %d pages in %d ticks\n", what, (int)best, uptime() - t0);
+  return best;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxsteps = 12, old;
+  uint64 step, off, on;
+
+  if(argc > 1)
+    maxsteps = atoi(argv[1]);
+
+  step = freepages() / 4;
+  printf("largest working set, in steps of %d pages:\n", (int)step);
+  old = zswapctl(0);
+  off = largest("without zswap", step, maxsteps);
+  zswapctl(ZSWAP_COMPRESS);
+  on = largest("with zswap", step, maxsteps);
+  zswapctl(old);
+
+  freepages();
+  printf("zswap: %d pages in %d bytes, %d out, %d in\n",
+         (int)st.nzswap, (int)st.zsbytes, (int)st.zsout, (int)st.zsin);
+  if(on < off){
+    printf("zswapbench: smaller working set with zswap\n");
+    exit(1);
+  }
+  exit(0);
+}